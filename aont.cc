@@ -1,7 +1,9 @@
 #include "aont.hh"
 #include "slss.hh"
 
+#include <algorithm>
 #include <cstring>
+#include <endian.h>
 #include <fcntl.h>
 #include <fstream>
 #include <iomanip>
@@ -10,13 +12,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-const size_t       BUFF_SIZE = 4096;
 const EVP_MD     * DEFAULT_MD_type = nullptr;
 const EVP_CIPHER * DEFAULT_CIPHER  = nullptr;
 ENGINE           * DEFAULT_ENGINE  = nullptr;
 
 #define DUMP(x) dump(#x, x)
 
+static const char    PACKAGE_MAGIC[8] = {'\x89','A','O','N','T','\r','\n','\x1a'};
+static const uint8_t PACKAGE_VERSION  = 1;
+
 /**
  * @brief Dump the string to STDOUT if ${DBG}
  *
@@ -55,83 +59,315 @@ static void randomise(std::string & str)
 }
 
 /**
- * @brief Fidd str with cryptographically random data.
- *
- * @param str Buffer to fill
- * @param len Size of buffer
- */
-static void randomise(std::string & str, size_t len)
-{
-  str.resize(len);
-  randomise(str);
-}
-
-/**
- * @brief return byte-wise XOR of a and b.
+ * @brief byte-wise XOR of a and b into out.
  *
+ * @param out len bytes, may be a or b
  * @param a
  * @param b
- *
- * @return a ^ b
+ * @param len
  */
-static std::string Xor(const std::string & a, const std::string & b)
+static void Xor(void * out, const void * a, const void * b, size_t len)
 {
-  attest(a.length() == b.length(),
-         "cannot Xor([%zu],[%zu])",
-         a.length(), b.length());
-  std::string ret(a);
-  for (size_t i = 0; i < b.length(); ++i)
+  uint8_t       * o  = static_cast<uint8_t *>(out);
+  const uint8_t * pa = static_cast<const uint8_t *>(a);
+  const uint8_t * pb = static_cast<const uint8_t *>(b);
+  for (size_t i = 0; i < len; ++i)
   {
-    ret[i] ^= b[i];
+    o[i] = pa[i] ^ pb[i];
   }
-  return ret;
 }
 
 /**
- * @brief write the buffer to the given file
+ * @brief write the whole buffer to the given file
  *
  * @param fd file to write to
  * @param buff buffer to write
+ * @param len number of bytes to write
  */
-static void write(int fd, const std::string & buff)
+static void writeFully(int fd, const void * buff, size_t len)
 {
-  size_t rc = write(fd, &buff[0], buff.length());
-  attest(rc == (size_t)buff.length(),
-         "write(%d,%%p,%zu): %zd (%m)",
-         fd, buff.length(), rc);
+  const char * p = static_cast<const char *>(buff);
+  while (len)
+  {
+    const ssize_t rc = write(fd, p, len);
+    attest(rc > 0,
+           "write(%d,%%p,%zu): %zd (%m)",
+           fd, len, rc);
+    p   += rc;
+    len -= rc;
+  }
 }
 
 /**
- * @brief Read from the given file descriptor
+ * @brief Read from the given file descriptor into buff
  *
  * @param fd file to read from
+ * @param buff buffer to read into
  * @param len number of bytes to read
  * @param exact enforce reading exactly
  *
- * @return up to len bytes, or exactly len bytes.
+ * @return len bytes, fewer only at EOF (which exact forbids)
  */
-static std::string read(int fd, size_t len, bool exact)
+static size_t read(int fd, void * buff, size_t len, bool exact)
 {
-  std::string ret;
-  ret.resize(len);
+  char * p = static_cast<char *>(buff);
+  size_t ret = 0;
   errno = 0;
-  const ssize_t rc = read(fd, &ret[0], ret.length());
-  if (exact)
-  {
-    attest(rc == (ssize_t)ret.length(),
-           "failed to read exactly %zu bytes, got %zd (%m)",
-           ret.length(), rc);
-  }
-  else
+  while (ret < len)
   {
+    const ssize_t rc = read(fd, p + ret, len - ret);
     attest(rc >= 0,
            "read(%d,%%p,%zu) failed: %m",
-           fd, ret.length());
-    ret.resize(rc);
+           fd, len - ret);
+    if (rc == 0)
+    {
+      break;
+    }
+    ret += rc;
+  }
+
+  if (exact)
+  {
+    attest(ret == len,
+           "failed to read exactly %zu bytes, got %zu (%m)",
+           len, ret);
   }
   return ret;
 }
 
+/**
+ * @brief does the package need a header, i.e. not use the defaults?
+ */
+static bool needHeader(Digest & digest, Cipher & cipher,
+                       const PackageOptions & options)
+{
+  return ((digest.nid() != NID_sha384) ||
+          (cipher.nid() != NID_aes_256_cbc) ||
+          options.segmentSize ||
+          options.compression);
+}
+
+/**
+ * @brief fill in the package header for the given digest, cipher and options
+ */
+static void makeHeader(packageHeader & hdr, Digest & digest, Cipher & cipher,
+                       const PackageOptions & options)
+{
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, PACKAGE_MAGIC, sizeof(hdr.magic));
+  hdr.version = PACKAGE_VERSION;
+  hdr.cipher  = htobe16(cipher.nid());
+  hdr.digest  = htobe16(digest.nid());
+  if (options.compression)
+  {
+    attest((options.compression >= Z_BEST_SPEED) &&
+           (options.compression <= Z_BEST_COMPRESSION),
+           "compression level must be between %d and %d",
+           Z_BEST_SPEED, Z_BEST_COMPRESSION);
+    hdr.flags |= PACKAGE_ZLIB;
+  }
+  if (options.segmentSize)
+  {
+    hdr.segmentPo2 = __builtin_ctzll(options.segmentSize);
+    attest(((size_t)1 << hdr.segmentPo2) == options.segmentSize &&
+           (hdr.segmentPo2 >= MIN_SEGMENT_Po2) &&
+           (hdr.segmentPo2 <= MAX_SEGMENT_Po2),
+           "segment size must be a power of 2 between 2^%u and 2^%u",
+           (unsigned)MIN_SEGMENT_Po2, (unsigned)MAX_SEGMENT_Po2);
+  }
+}
+
+/**
+ * @brief check the given package header, extracting the digest and cipher
+ *
+ * @return false if hdr isn't a package header at all
+ */
+static bool parseHeader(const packageHeader & hdr,
+                        const EVP_MD     *& md,
+                        const EVP_CIPHER *& cipher)
+{
+  if (memcmp(hdr.magic, PACKAGE_MAGIC, sizeof(hdr.magic)))
+  {
+    return false;
+  }
+  attest(hdr.version == PACKAGE_VERSION,
+         "unsupported package version %u", (unsigned)hdr.version);
+  attest(!(hdr.flags & ~PACKAGE_ZLIB) && !hdr.reserved,
+         "unsupported package options");
+  // the decrypter buffers a whole segment, don't trust the size blindly
+  attest(!hdr.segmentPo2 ||
+         ((hdr.segmentPo2 >= MIN_SEGMENT_Po2) &&
+          (hdr.segmentPo2 <= MAX_SEGMENT_Po2)),
+         "unsupported segment size 2^%u, must be between 2^%u and 2^%u",
+         (unsigned)hdr.segmentPo2,
+         (unsigned)MIN_SEGMENT_Po2, (unsigned)MAX_SEGMENT_Po2);
+  md     = EVP_get_digestbynid(be16toh(hdr.digest));
+  cipher = EVP_get_cipherbynid(be16toh(hdr.cipher));
+  attest(md,     "unknown digest %u", (unsigned)be16toh(hdr.digest));
+  attest(cipher, "unknown cipher %u", (unsigned)be16toh(hdr.cipher));
+  return true;
+}
+
+/**
+ * @brief stretch (or truncate) the package hash to cover the IV and key
+ *
+ * mask = hash + H(hash + 1) + H(hash + 2) + ...
+ *
+ * so with the default digest and cipher the mask is just the hash.
+ *
+ * @param digest digest to (re-)use
+ * @param hash package hash, digest.length() bytes
+ * @param mask len bytes
+ * @param len IV plus key length
+ */
+static void keyMask(Digest & digest,
+                    const uint8_t * hash,
+                    uint8_t * mask,
+                    const size_t len)
+{
+  const size_t mdLen = digest.length();
+  memcpy(mask, hash, std::min(mdLen, len));
+  uint8_t block[EVP_MAX_MD_SIZE];
+  uint8_t ctr = 0;
+  for (size_t off = mdLen; off < len; off += mdLen)
+  {
+    ++ctr;
+    digest.reset();
+    digest.update(hash, mdLen);
+    digest.update(&ctr, sizeof(ctr));
+    digest.final(block);
+    memcpy(mask + off, block, std::min(mdLen, len - off));
+  }
+}
+
+/// write plaintext to a file descriptor, inflate()ing it if needed
+class PlaintextWriter
+{
+public:
+  PlaintextWriter(const int _fd, const bool _compressed)
+    : fd(_fd)
+    , compressed(_compressed)
+    , done(false)
+    {
+      if (!compressed)
+      {
+        return;
+      }
+      out.resize(SLICE_SIZE);
+      memset(&strm, 0, sizeof(strm));
+      const int rc = inflateInit(&strm);
+      attest(rc == Z_OK, "inflateInit() failed: %d", rc);
+    };
+
+  virtual ~PlaintextWriter()
+    {
+      if (compressed)
+      {
+        inflateEnd(&strm);
+      }
+    };
+
+  void write(const void * buff, size_t len)
+    {
+      if (!compressed)
+      {
+        writeFully(fd, buff, len);
+        return;
+      }
+      strm.next_in  = (Bytef *)buff;
+      strm.avail_in = len;
+      // until all the input is used and all the output written
+      do
+      {
+        attest(!done || !strm.avail_in,
+               "trailing data after compressed stream");
+        strm.next_out  = &out[0];
+        strm.avail_out = out.size();
+        const int rc = inflate(&strm, Z_NO_FLUSH);
+        attest((rc == Z_OK) || (rc == Z_STREAM_END) || (rc == Z_BUF_ERROR),
+               "inflate() failed: %d", rc);
+        done |= (rc == Z_STREAM_END);
+        writeFully(fd, &out[0], out.size() - strm.avail_out);
+      } while (strm.avail_in || !strm.avail_out);
+    };
+
+  // make sure the compressed stream was complete and close the file
+  void finish()
+    {
+      attest(!compressed || done, "truncated compressed stream");
+      close(fd);
+    };
+
+private:
+  int  fd;
+  bool compressed;
+  bool done;
+  std::vector<uint8_t> out;
+  z_stream strm;
+};
+
+/**
+ * @brief deflate() what's read from the given file descriptor
+ *
+ * @param _fd File descriptor to read from, closed at EOF
+ * @param level zlib compression level
+ * @param readSize number of bytes to read at a time
+ */
+CompressingReader::CompressingReader(const int _fd,
+                                     const int level,
+                                     const size_t readSize)
+  : fd(_fd)
+  , eof(false)
+  , done(false)
+  , in(readSize)
+{
+  memset(&strm, 0, sizeof(strm));
+  const int rc = deflateInit(&strm, level);
+  attest(rc == Z_OK, "deflateInit() failed: %d", rc);
+};
+
+CompressingReader::~CompressingReader()
+{
+  deflateEnd(&strm);
+};
+
+/**
+ * @brief read up to len bytes of compressed data
+ *
+ * @return number of bytes read, 0 once the compressed stream is complete
+ */
+size_t CompressingReader::read(void * pBuff, const size_t len)
+{
+  strm.next_out  = static_cast<Bytef *>(pBuff);
+  strm.avail_out = len;
+  while (strm.avail_out && !done)
+  {
+    if (!strm.avail_in && !eof)
+    {
+      // don't block for more input if there's already something to return
+      if (strm.avail_out != len)
+      {
+        break;
+      }
+      const ssize_t numRead = ::read(fd, &in[0], in.size());
+      attest(numRead >= 0, "read(%d,%%p,%zu) failed: %m", fd, in.size());
+      if (numRead == 0)
+      {
+        close(fd);
+        fd  = -1;
+        eof = true;
+      }
+      strm.next_in  = &in[0];
+      strm.avail_in = numRead;
+    }
+    const int rc = deflate(&strm, eof ? Z_FINISH : Z_NO_FLUSH);
+    attest((rc == Z_OK) || (rc == Z_STREAM_END) || (rc == Z_BUF_ERROR),
+           "deflate() failed: %d", rc);
+    done = (rc == Z_STREAM_END);
+  }
+  return len - strm.avail_out;
+}
+
 // forward declatarion to allow friend-ing. Lol.
 class Digest2;
 
@@ -169,15 +405,27 @@ void Digest::update(const void * buff, size_t len)
 std::string Digest::final()
 {
   unsigned char hash[EVP_MAX_MD_SIZE];
-  unsigned int  len = sizeof(hash);
+  return std::string(hash, hash + final(hash));
+}
+
+/**
+ * @brief finish the digest
+ *
+ * @param out room for length() bytes
+ *
+ * @return number of bytes written to out
+ */
+size_t Digest::final(void * out)
+{
+  unsigned int len = EVP_MAX_MD_SIZE;
 
-  const int rc = EVP_DigestFinal_ex(ctx, hash, &len);
+  const int rc = EVP_DigestFinal_ex(ctx, (unsigned char *)out, &len);
   attest(rc == 1, "EVP_DigestFinal_ex() failed\n");
   attest(len <= EVP_MAX_MD_SIZE,
          "Digest too big: %u > %d", len, EVP_MAX_MD_SIZE);
   attest(len == length(), "unexpected hash length: %u != %zu",
          len, length());
-  return std::string(hash, hash+len);
+  return len;
 }
 
 std::string Digest::final(const std::string & buff)
@@ -191,10 +439,14 @@ std::string Digest::final(const void * buff, size_t len)
   return final();
 };
 
+/**
+ * @brief get ready to hash the next message, re-using the context
+ */
 void Digest::reset()
 {
-  Destroy();
-  Create();
+  const int rc = EVP_MD_CTX_reset(ctx);
+  attest(rc == 1, "EVP_MD_CTX_reset() failed");
+  Init();
 };
 
 size_t Digest::length()
@@ -202,10 +454,20 @@ size_t Digest::length()
   return EVP_MD_size(type);
 };
 
+int Digest::nid()
+{
+  return EVP_MD_type(type);
+};
+
 void Digest::Create()
 {
   ctx = EVP_MD_CTX_create();
   attest(ctx != nullptr, "EVP_MD_CTX_create() failed");
+  Init();
+};
+
+void Digest::Init()
+{
   const int rc = EVP_DigestInit_ex(ctx, type, impl);
   attest(rc == 1, "EVP_DigestInit_ex() failed");
 };
@@ -215,6 +477,9 @@ void Digest::Destroy()
   EVP_MD_CTX_destroy(ctx);
 };
 
+/// H2's zero prefix
+static const unsigned char ZEROS[EVP_MAX_MD_SIZE] = {0,};
+
 /**
  * @brief Nested cryptographic hash to avoid extension attacks
  *
@@ -227,21 +492,162 @@ void Digest::Destroy()
 Digest2::Digest2(const EVP_MD * _type, ENGINE * _impl)
   : Digest(_type, _impl)
 {
-  update(std::string(length(), '\0'));
+  update(ZEROS, length());
 };
 
-std::string Digest2::final()
+size_t Digest2::final(void * out)
 {
-  Digest d(type, impl);
-  return d.final(Digest::final());
+  unsigned char hash[EVP_MAX_MD_SIZE];
+  const size_t len = Digest::final(hash);
+  // the outer hash re-uses the same context
+  Digest::reset();
+  update(hash, len);
+  return Digest::final(out);
 };
 
 void Digest2::reset()
 {
   Digest::reset();
-  update(std::string(length(), '\0'));
+  update(ZEROS, length());
+};
+
+
+/**
+ * @brief Digest buffers on a background thread
+ *
+ * Lets encryption (or decryption) and hashing run concurrently.
+ * Buffers passed to update() must stay unchanged until wait() returns.
+ * Without a spare core everything is simply digested in update().
+ *
+ * @param _digest Digest to update, must not be touched until wait()
+ */
+DigestThread::DigestThread(Digest & _digest)
+  : head(0)
+  , tail(0)
+  , done(false)
+  , sleepers(0)
+  , digest(_digest)
+{
+  if (std::thread::hardware_concurrency() > 1)
+  {
+    thread = std::thread(&DigestThread::run, this);
+  }
+};
+
+DigestThread::~DigestThread()
+{
+  done = true;
+  wake();
+  if (thread.joinable())
+  {
+    thread.join();
+  }
 };
 
+/**
+ * @brief queue len bytes at buff to be digested
+ */
+void DigestThread::update(const void * buff, size_t len)
+{
+  if (!thread.joinable())
+  {
+    digest.update(buff, len);
+    return;
+  }
+  const size_t h = head.load(std::memory_order_relaxed);
+  // wait for a free slot
+  await([&]() { return (h - tail.load(std::memory_order_acquire)) < SLOTS; });
+  queue[h % SLOTS] = {buff, len};
+  head.store(h + 1, std::memory_order_release);
+  wake();
+};
+
+/**
+ * @brief wait until everything queued has been digested, rethrowing
+ * anything the digest threw
+ */
+void DigestThread::wait()
+{
+  const size_t h = head.load(std::memory_order_relaxed);
+  await([&]() { return tail.load(std::memory_order_acquire) == h; });
+  if (thrown)
+  {
+    std::rethrow_exception(thrown);
+  }
+};
+
+void DigestThread::run()
+{
+  while (1)
+  {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+    {
+      if (done)
+      {
+        return;
+      }
+      await([&]()
+            { return done || (head.load(std::memory_order_acquire) != t); });
+      continue;
+    }
+    try
+    {
+      digest.update(queue[t % SLOTS].buff, queue[t % SLOTS].len);
+    }
+    catch (...)
+    {
+      // keep taking them so update() doesn't wait forever, wait()
+      // rethrows it
+      if (!thrown)
+      {
+        thrown = std::current_exception();
+      }
+    }
+    tail.store(t + 1, std::memory_order_release);
+    wake();
+  }
+};
+
+/**
+ * @brief wait for the other side until ready(): spin briefly, then
+ * yield, then sleep until woken
+ */
+void DigestThread::await(const std::function<bool()> & ready)
+{
+  for (unsigned spins = 0; !ready(); ++spins)
+  {
+    if (spins < 1024)
+    {
+      if (spins >= 64)
+      {
+        std::this_thread::yield();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    ++sleepers;
+    // pairs with the fence in wake(): either it sees a sleeper or
+    // ready() sees what it woke us for
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv.wait(lock, ready);
+    --sleepers;
+    return;
+  }
+};
+
+/**
+ * @brief wake the other side if it's asleep in await()
+ */
+void DigestThread::wake()
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers.load(std::memory_order_relaxed))
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    cv.notify_all();
+  }
+};
 
 /**
  * @brief Stream cipher
@@ -269,6 +675,14 @@ size_t Cipher::ivLength()
 {
   return EVP_CIPHER_iv_length(type);
 };
+size_t Cipher::blockSize()
+{
+  return EVP_CIPHER_block_size(type);
+};
+int Cipher::nid()
+{
+  return EVP_CIPHER_nid(type);
+};
 
 /**
  * @brief Encryptor
@@ -279,11 +693,25 @@ size_t Cipher::ivLength()
 Encrypter::Encrypter(const EVP_CIPHER *_type, ENGINE *_impl)
   : Cipher(_type, _impl)
 {
-  randomise(key, keyLength());
-  randomise(iv,  ivLength());
+  key.resize(keyLength());
+  iv.resize(ivLength());
+  rekey();
+};
+
+/**
+ * @brief pick a fresh random key and IV, re-using the context
+ */
+void Encrypter::rekey()
+{
+  randomise(key);
+  randomise(iv);
   dump("Key: ", key);
   dump("IV : ", iv);
+  init();
+};
 
+void Encrypter::init()
+{
   int rc = EVP_EncryptInit_ex(
     ctx, type, impl,
     (unsigned char *)&key[0],
@@ -301,125 +729,207 @@ const std::string & Encrypter::getIV() {return iv; };
 std::string Encrypter::update(const std::string & buff)
 {
   std::string ret;
-  ret.resize(buff.length() + EVP_CIPHER_block_size(type));
-  int outl = ret.length();
+  ret.resize(buff.length() + blockSize());
+  ret.resize(update(&buff[0], buff.length(), &ret[0]));
+  return ret;
+};
+
+/**
+ * @brief Encrypt len bytes from buff into out
+ *
+ * @param buff plaintext
+ * @param len length of plaintext
+ * @param out ciphertext, must have room for len + blockSize() bytes
+ *
+ * @return number of bytes written to out
+ */
+size_t Encrypter::update(const void * buff, size_t len, void * out)
+{
+  int outl = len + blockSize();
 
   int rc = EVP_EncryptUpdate(
     ctx,
-    (unsigned char *)&ret [0], & outl,
-    (unsigned char *)&buff[0], buff.length());
+    (unsigned char *)out,  & outl,
+    (const unsigned char *)buff, len);
   attest(rc == 1, "EVP_EncryptUpdate() fail");
 
-  attest(outl <= (int)ret.length(),
+  attest(outl <= (int)(len + blockSize()),
          "EVP_EncryptUpdate() returned too much, %d > %zu",
-         outl, ret.length());
-  ret.resize(outl);
+         outl, len + blockSize());
 
-  return ret;
+  return outl;
 };
 
 std::string Encrypter::final()
 {
   std::string ret;
-  ret.resize(EVP_CIPHER_block_size(type));
-  int outl = ret.length();
+  ret.resize(blockSize());
+  ret.resize(final(&ret[0]));
+  return ret;
+};
+
+/**
+ * @brief Flush the last (padded) block
+ *
+ * @param out ciphertext, must have room for blockSize() bytes
+ *
+ * @return number of bytes written to out
+ */
+size_t Encrypter::final(void * out)
+{
+  int outl = blockSize();
 
   int rc = EVP_EncryptFinal_ex(
     ctx,
-    (unsigned char *)&ret[0], &outl);
+    (unsigned char *)out, &outl);
   attest(rc == 1, "EVP_EncryptFinal_ex() fail");
 
-  attest(outl <= (int)ret.length(),
+  attest(outl <= (int)blockSize(),
          "EVP_EncryptFinal_ex() returned too much, %d > %zu",
-         outl, ret.length());
-  ret.resize(outl);
+         outl, blockSize());
 
-  return ret;
+  return outl;
 };
 
-class Decrypter : public Cipher
+/**
+ * @brief Decryptor
+ *
+ * @param _type Cipher
+ * @param _impl Implementation
+ */
+Decrypter::Decrypter(const std::string & key,
+                     const std::string & iv,
+                     const EVP_CIPHER *_type,
+                     ENGINE *_impl)
+  : Cipher(_type, _impl)
 {
-public:
-  Decrypter(const std::string & key,
-            const std::string & iv,
-            const EVP_CIPHER *_type,
-            ENGINE *_impl)
-    : Cipher(_type, _impl)
-    {
-      init(key, iv);
-    };
+  attest(key.length() == keyLength(),
+         "Unexpected key length: %zu vz %zu",
+         key.length(), keyLength());
+  attest(iv.length() == ivLength(),
+         "Unexpected IV length: %zu vz %zu",
+         iv.length(), ivLength());
+  init(&key[0], &iv[0]);
+};
 
-  Decrypter(const std::string & keyAndIV,
-            const EVP_CIPHER *_type, ENGINE *_impl)
-    : Cipher(_type, _impl)
-    {
-      const std::string iv (keyAndIV.substr(0, ivLength()));
-      const std::string key(keyAndIV.substr(ivLength()));
-      init(key, iv);
-    };
+Decrypter::Decrypter(const std::string & keyAndIV,
+                     const EVP_CIPHER *_type,
+                     ENGINE *_impl)
+  : Cipher(_type, _impl)
+{
+  attest(keyAndIV.length() == ivLength() + keyLength(),
+         "Unexpected key length: %zu vz %zu",
+         keyAndIV.length(), ivLength() + keyLength());
+  rekey(&keyAndIV[0]);
+};
 
-  virtual ~Decrypter()
-    {
-      ;
-    };
+/**
+ * @brief Decryptor, rekey() must be called before use
+ *
+ * @param _type Cipher
+ * @param _impl Implementation
+ */
+Decrypter::Decrypter(const EVP_CIPHER *_type,
+                     ENGINE *_impl)
+  : Cipher(_type, _impl)
+{
+  ;
+};
 
-  std::string update(const std::string & buff)
-    {
-      std::string ret;
-      ret.resize(buff.length() + EVP_CIPHER_block_size(type));
-      int outl = ret.length();
-
-      int rc = EVP_DecryptUpdate(
-        ctx,
-        (unsigned char *)&ret [0], & outl,
-        (unsigned char *)&buff[0], buff.length());
-      attest(rc == 1, "EVP_DecryptUpdate() failed");
-
-      attest(outl <= (int)ret.length(),
-             "EVP_DecryptUpdate() returned too much, %d > %zu",
-             outl, ret.length());
-      ret.resize(outl);
-      return ret;
-    };
+Decrypter::~Decrypter()
+{
+  ;
+};
 
-  std::string final()
-    {
-      std::string ret;
-      ret.resize(EVP_CIPHER_block_size(type));
-      int outl = ret.length();
-
-      const int rc = EVP_DecryptFinal_ex(
-        ctx,
-        (unsigned char *)&ret[0], &outl);
-      attest(rc == 1,
-             "EVP_DecryptFinal_e([%d]->[%d]) fail",
-             EVP_CIPHER_block_size(type), outl);
-
-      attest(outl <= (int)ret.length(),
-             "EVP_DecryptFinal_ex() block oversize: %d > %zu",
-             outl, ret.length());
-      ret.resize(outl);
-      return ret;
-    };
-private:
-  void init(const std::string & key,
-            const std::string & iv)
-    {
-      attest(key.length() == keyLength(),
-             "Unexpected key length: %zu vz %zu",
-             key.length(), keyLength());
-      const int rc = EVP_DecryptInit_ex(ctx, type, impl,
-                                        (unsigned char *)&key[0],
-                                        (unsigned char *)&iv[0]);
-      attest(rc == 1, "EVP_DecryptInit_ex() failed: %d\n", rc);
-    };
+/**
+ * @brief start decrypting with a new IV and key, re-using the context
+ *
+ * @param keyAndIV ivLength() bytes of IV followed by keyLength() bytes of key
+ */
+void Decrypter::rekey(const void * keyAndIV)
+{
+  const uint8_t * iv = static_cast<const uint8_t *>(keyAndIV);
+  init(iv + ivLength(), iv);
+};
+
+void Decrypter::init(const void * key, const void * iv)
+{
+  const int rc = EVP_DecryptInit_ex(ctx, type, impl,
+                                    (const unsigned char *)key,
+                                    (const unsigned char *)iv);
+  attest(rc == 1, "EVP_DecryptInit_ex() failed: %d\n", rc);
+};
 
+std::string Decrypter::update(const std::string & buff)
+{
+  std::string ret;
+  ret.resize(buff.length() + blockSize());
+  ret.resize(update(&buff[0], buff.length(), &ret[0]));
+  return ret;
 };
 
 /**
- * @brief decrypt the given file to stdout
+ * @brief Decrypt len bytes from buff into out
+ *
+ * @param buff ciphertext
+ * @param len length of ciphertext
+ * @param out plaintext, must have room for len + blockSize() bytes
  *
- * @param filename File to decrypt
+ * @return number of bytes written to out
+ */
+size_t Decrypter::update(const void * buff, size_t len, void * out)
+{
+  int outl = len + blockSize();
+
+  int rc = EVP_DecryptUpdate(
+    ctx,
+    (unsigned char *)out,  & outl,
+    (const unsigned char *)buff, len);
+  attest(rc == 1, "EVP_DecryptUpdate() failed");
+
+  attest(outl <= (int)(len + blockSize()),
+         "EVP_DecryptUpdate() returned too much, %d > %zu",
+         outl, len + blockSize());
+  return outl;
+};
+
+std::string Decrypter::final()
+{
+  std::string ret;
+  ret.resize(blockSize());
+  ret.resize(final(&ret[0]));
+  return ret;
+};
+
+/**
+ * @brief Check and strip the padding of the last block
+ *
+ * @param out plaintext, must have room for blockSize() bytes
+ *
+ * @return number of bytes written to out
+ */
+size_t Decrypter::final(void * out)
+{
+  int outl = blockSize();
+
+  const int rc = EVP_DecryptFinal_ex(
+    ctx,
+    (unsigned char *)out, &outl);
+  attest(rc == 1,
+         "EVP_DecryptFinal_e([%zu]->[%d]) fail",
+         blockSize(), outl);
+
+  attest(outl <= (int)blockSize(),
+         "EVP_DecryptFinal_ex() block oversize: %d > %zu",
+         outl, blockSize());
+  return outl;
+};
+
+/**
+ * @brief decrypt the given file to the given file
+ *
+ * @param encrypted File to decrypt
+ * @param plaintext File to create
  */
 void decrypt(const std::string & encrypted,
              const std::string & plaintext,
@@ -427,123 +937,447 @@ void decrypt(const std::string & encrypted,
              const EVP_CIPHER  * cipher,
              ENGINE            * engine)
 {
-
-  // open the file to decrypt
-  int fd = open(encrypted.c_str(), O_RDONLY);
-  attest(fd != -1, "open(%s, RDONLY): %m", encrypted.c_str());
   int fdOut = open(plaintext.c_str(),
                     O_WRONLY | O_CREAT | O_TRUNC,
                    S_IRUSR | S_IWUSR);
   attest(fdOut != -1, "open(%s, WRONLY): %m", plaintext.c_str());
 
+  decrypt(encrypted, fdOut, md, cipher, engine);
+}
+
+/**
+ * @brief decrypt the given file to the given file descriptor
+ *
+ * The whole file is hashed (recovering the key) before any plaintext
+ * is written, so fdOut may be a pipe to a streaming consumer.
+ *
+ * @param encrypted File to decrypt
+ * @param fdOut File descriptor to write the plaintext to, closed when done
+ */
+void decrypt(const std::string & encrypted,
+             int fdOut,
+             const EVP_MD      * md,
+             const EVP_CIPHER  * cipher,
+             ENGINE            * engine)
+{
+
+  // open the file to decrypt
+  int fd = open(encrypted.c_str(), O_RDONLY);
+  attest(fd != -1, "open(%s, RDONLY): %m", encrypted.c_str());
+
+  decrypt(fd, fdOut, md, cipher, engine);
+  close(fd);
+}
+
+/**
+ * @brief decrypt a segmented package in a single pass
+ *
+ * Each segment is a complete package of its own, so only one segment
+ * needs to be buffered. Every segment but the last is full.
+ *
+ * @param fd File descriptor to read from, just past the header
+ * @param fdOut File descriptor to write the plaintext to, closed when done
+ * @param hdr Package header
+ */
+static void decryptSegments(int fd,
+                            int fdOut,
+                            const packageHeader & hdr,
+                            const EVP_MD      * md,
+                            const EVP_CIPHER  * cipher,
+                            ENGINE            * engine)
+{
+  Digest2   digest(md, engine);
+  Decrypter decrypter(cipher, engine);
+
+  // ciphertext of a full segment (CBC et al. add a block of padding)
+  const size_t segmentSize = (size_t)1 << hdr.segmentPo2;
+  const size_t bs          = decrypter.blockSize();
+  const size_t full        = (bs == 1) ? segmentSize : ((segmentSize / bs) + 1) * bs;
+  const size_t encLen      = decrypter.ivLength() + decrypter.keyLength();
+
+  std::vector<uint8_t> buff(full + encLen);
+  std::vector<uint8_t> plain(SLICE_SIZE + EVP_MAX_BLOCK_LENGTH);
+  PlaintextWriter      writer(fdOut, hdr.flags & PACKAGE_ZLIB);
+
+  for (uint64_t segment = 0; ; ++segment)
+  {
+    const size_t numRead = read(fd, &buff[0], buff.size(), false);
+    attest(numRead >= encLen, "truncated segment %zu",
+           (size_t)segment);
+    const size_t len = numRead - encLen;
+
+    // H2(header + segment number + ciphertext)
+    const uint64_t idx = htobe64(segment);
+    digest.reset();
+    digest.update(&hdr, sizeof(hdr));
+    digest.update(&idx, sizeof(idx));
+    digest.update(&buff[0], len);
+    uint8_t hash[EVP_MAX_MD_SIZE];
+    digest.final(hash);
+
+    // recover the key and the IV
+    uint8_t keyAndIV[EVP_MAX_IV_LENGTH + EVP_MAX_KEY_LENGTH];
+    keyMask(digest, hash, keyAndIV, encLen);
+    Xor(keyAndIV, keyAndIV, &buff[len], encLen);
+    decrypter.rekey(keyAndIV);
+
+    for (size_t off = 0; off < len; off += SLICE_SIZE)
+    {
+      const size_t num = std::min(len - off, (size_t)SLICE_SIZE);
+      writer.write(&plain[0],
+                   decrypter.update(&buff[off], num, &plain[0]));
+    }
+    writer.write(&plain[0], decrypter.final(&plain[0]));
+
+    // the last segment is never full
+    if (numRead < buff.size())
+    {
+      break;
+    }
+  }
+  writer.finish();
+}
+
+/**
+ * @brief does the package starting with the len bytes at start have a
+ * segmented package header?
+ */
+bool isSegmented(const void * start, size_t len)
+{
+  packageHeader hdr;
+  if (len < sizeof(hdr))
+  {
+    return false;
+  }
+  memcpy(&hdr, start, sizeof(hdr));
+  return !memcmp(hdr.magic, PACKAGE_MAGIC, sizeof(hdr.magic)) &&
+    hdr.segmentPo2;
+}
+
+/**
+ * @brief decrypt the given file descriptor to the given file descriptor
+ *
+ * Single packages are read twice, once to recover the key and once to
+ * decrypt, so fdIn must be seekable. Segmented packages are read once.
+ *
+ * @param fd File descriptor to read from
+ * @param fdOut File descriptor to write the plaintext to, closed when done
+ */
+void decrypt(int fd,
+             int fdOut,
+             const EVP_MD      * md,
+             const EVP_CIPHER  * cipher,
+             ENGINE            * engine)
+{
+  // does the package name its own digest and cipher?
+  packageHeader hdr;
+  size_t start = 0;
+  if ((read(fd, &hdr, sizeof(hdr), false) == sizeof(hdr)) &&
+      parseHeader(hdr, md, cipher))
+  {
+    if (hdr.segmentPo2)
+    {
+      decryptSegments(fd, fdOut, hdr, md, cipher, engine);
+      return;
+    }
+    start = sizeof(hdr);
+  }
+
   // find out how big it is
   struct stat buf;
   const int rc = fstat(fd, &buf);
   attest(rc == 0, "fstat() failed: %m");
+  attest(S_ISREG(buf.st_mode),
+         "unsegmented packages can only be decrypted from a file");
+  lseek(fd, start, SEEK_SET);
+
+  Digest2   digest(md, engine);
+  Decrypter decrypter(cipher, engine);
+  digest.update(&hdr, start);
 
   // how much of the file is 'data'?
-  Digest2 digest(md, engine);
-  size_t len = buf.st_size - digest.length();
+  const size_t mdLen  = digest.length();
+  const size_t encLen = decrypter.ivLength() + decrypter.keyLength();
+  attest((size_t)buf.st_size >= start + encLen,
+         "package too short");
+  size_t len = buf.st_size - start - encLen;
   size_t rem = len;
+
+  // one set of buffers for the whole file
+  std::vector<uint8_t> buff(DEFAULT_READ_SIZE);
+  std::vector<uint8_t> plain(DEFAULT_READ_SIZE + EVP_MAX_BLOCK_LENGTH);
+  PlaintextWriter      writer(fdOut, start && (hdr.flags & PACKAGE_ZLIB));
+
   // first pass, read all the ciphertext
   while(rem)
   {
-    // read up to BUFF_SIZE bytes at a time ...
-    std::string buff = read(fd, std::min(rem, BUFF_SIZE), true);
-    // redundant, read() would have attested...
-    attest(buff.length(), "unexpected EOF (%zu)", rem);
+    // read up to a buffer full at a time ...
+    const size_t numRead = read(fd, &buff[0], std::min(rem, buff.size()), true);
     // and digest them.
-    rem -= buff.length();
-    digest.update(buff);
+    rem -= numRead;
+    digest.update(&buff[0], numRead);
   }
   // hash of the data area
-  std::string hash = digest.final();
+  uint8_t hash[EVP_MAX_MD_SIZE];
+  digest.final(hash);
 
-  // now read the encrypted key and ensure it's really EOF
-  std::string enc = read(fd, digest.length(), true);
-  std::string eof = read(fd, 1, false);
-  attest(eof.length() == 0, "not EOF: %zu", eof.length());
+  // now read the encrypted IV and key and ensure it's really EOF
+  uint8_t enc[EVP_MAX_IV_LENGTH + EVP_MAX_KEY_LENGTH];
+  read(fd, enc, encLen, true);
+  size_t eof = read(fd, &buff[0], 1, false);
+  attest(eof == 0, "not EOF: %zu", eof);
 
   // recover the key and the IV
-  Decrypter decrypter(Xor(hash, enc), cipher, engine);
+  uint8_t keyAndIV[EVP_MAX_IV_LENGTH + EVP_MAX_KEY_LENGTH];
+  keyMask(digest, hash, keyAndIV, encLen);
+  Xor(keyAndIV, keyAndIV, enc, encLen);
+  decrypter.rekey(keyAndIV);
   digest.reset();
+  digest.update(&hdr, start);
 
-  lseek(fd, 0, SEEK_SET);
+  lseek(fd, start, SEEK_SET);
   rem = len;
-  while(rem)
   {
-    std::string buff = read(fd, std::min(rem, BUFF_SIZE), true);
-    attest(buff.length(), "unexpected EOF2 (%zu)", rem);
-    rem -= buff.length();
-    digest.update(buff);
-    write(fdOut, decrypter.update(buff));
+    // hash on one thread while decrypting on this one
+    DigestThread hasher(digest);
+    while(rem)
+    {
+      const size_t numRead = read(fd, &buff[0], std::min(rem, buff.size()), true);
+      rem -= numRead;
+      hasher.update(&buff[0], numRead);
+      writer.write(&plain[0],
+                   decrypter.update(&buff[0], numRead, &plain[0]));
+      // buff is about to be overwritten
+      hasher.wait();
+    }
   }
-  write(fdOut, decrypter.final());
-  close(fdOut);
+  writer.write(&plain[0], decrypter.final(&plain[0]));
+  writer.finish();
 
   // make sure that the second read of the data has the same hash ...
-  std::string hash2 = digest.final();
-  attest(hash == hash2, "hash mismatch!");
+  uint8_t hash2[EVP_MAX_MD_SIZE];
+  digest.final(hash2);
+  attest(!memcmp(hash, hash2, mdLen), "hash mismatch!");
 
   // ... and appended encrypted key
-  std::string enc2 = read(fd, digest.length(), true);
-  attest(enc == enc2, "enc mismatch!");
+  uint8_t enc2[EVP_MAX_IV_LENGTH + EVP_MAX_KEY_LENGTH];
+  read(fd, enc2, encLen, true);
+  attest(!memcmp(enc, enc2, encLen), "enc mismatch!");
 
   // ensure that we're at EOF
-  eof = read(fd, 1, false);
-  attest(eof.length() == 0, "not EOF2: %zu", eof.length());
+  eof = read(fd, &buff[0], 1, false);
+  attest(eof == 0, "not EOF2: %zu", eof);
 }
 
 EncryptingReader::EncryptingReader(const int _fd,
                                    const EVP_MD     * md,
                                    const EVP_CIPHER * cipher,
-                                   ENGINE           * engine)
+                                   ENGINE           * engine,
+                                   const PackageOptions & options,
+                                   const size_t       readSize)
 
   : fd(_fd)
   , eof(false)
+  , headerLen(0)
+  , segmentSize(options.segmentSize)
+  , segmentFill(0)
+  , segment(0)
+  , plain(readSize)
+  , head(0)
+  , tail(0)
   , digest(md, engine)
   , encrypter(cipher, engine)
+  , hasher(digest)
 {
+  attest(readSize > 0, "EncryptingReader: readSize must be > 0");
+  attest(!(EVP_CIPHER_flags(cipher ? cipher : EVP_aes_256_cbc()) &
+           EVP_CIPH_FLAG_AEAD_CIPHER) && encrypter.ivLength(),
+         "cipher %s is not supported",
+         OBJ_nid2sn(encrypter.nid()));
+  // big enough for a full chunk, or the final block plus encrypted key
+  cache.resize(chunkSize());
+
+  if (options.compression)
+  {
+    compressor.reset(new CompressingReader(fd, options.compression, readSize));
+  }
+
+  // non-default digest, cipher or options? name them in a header
+  memset(&header, 0, sizeof(header));
+  if (needHeader(digest, encrypter, options))
+  {
+    makeHeader(header, digest, encrypter, options);
+    headerLen = sizeof(header);
+    memcpy(&cache[0], &header, headerLen);
+    tail = headerLen;
+  }
+  startSegment();
 };
 
-ssize_t EncryptingReader::readFully(void * pBuff, const ssize_t len)
+/**
+ * @brief largest number of bytes a single chunk can encrypt to.
+ *
+ * Callers passing buffers at least this big to read() have the
+ * ciphertext written straight into their buffer, bypassing the cache.
+ */
+size_t EncryptingReader::chunkSize() const
+{
+  // ciphertext, plus the final block and encrypted key if the
+  // chunk completes a segment
+  return plain.size() + (2 * EVP_MAX_BLOCK_LENGTH) +
+    EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH;
+}
+
+/**
+ * @brief start hashing a (segment of the) package
+ *
+ * H2(header + ciphertext) or, for segments,
+ * H2(header + segment number + ciphertext)
+ */
+void EncryptingReader::startSegment()
 {
-  // keep topping up the cache until we wither have enough or there's no more to
-  while(!eof && static_cast<ssize_t>(cache.length()) < len)
+  digest.update(&header, headerLen);
+  if (segmentSize)
   {
-    // read next 4K
-    std::string buff = read(fd, BUFF_SIZE, false);
-    if (!eof && (buff.length() == 0))
+    const uint64_t idx = htobe64(segment);
+    digest.update(&idx, sizeof(idx));
+  }
+  segmentFill = 0;
+}
+
+/**
+ * @brief produce the final block and the encrypted IV and key
+ *
+ * @param out room for a block plus the IV and key
+ *
+ * @return number of bytes written to out
+ */
+size_t EncryptingReader::finishSegment(uint8_t * out)
+{
+  size_t len = encrypter.final(out);
+  digest.update(out, len);
+
+  // now get the hash calculated for the ciphertext
+  uint8_t hash[EVP_MAX_MD_SIZE];
+  digest.final(hash);
+
+  // XOR it with the IV and key and append
+  const std::string & iv  = encrypter.getIV();
+  const std::string & key = encrypter.getKey();
+  uint8_t mask[EVP_MAX_IV_LENGTH + EVP_MAX_KEY_LENGTH];
+  keyMask(digest, hash, mask, iv.length() + key.length());
+  Xor(out + len, &iv[0], mask, iv.length());
+  len += iv.length();
+  Xor(out + len, &key[0], mask + iv.length(), key.length());
+  return len + key.length();
+}
+
+/**
+ * @brief read and encrypt the next chunk of plaintext
+ *
+ * At EOF the final block and the encrypted key are produced instead.
+ * A chunk that completes a segment is followed by that segment's final
+ * block and encrypted key.
+ *
+ * @param out buffer of at least chunkSize() bytes
+ *
+ * @return number of bytes of ciphertext written to out (may be 0)
+ */
+size_t EncryptingReader::encryptChunk(uint8_t * out)
+{
+  // never read past the end of the segment
+  const size_t want = segmentSize ?
+    std::min(plain.size(), segmentSize - segmentFill) : plain.size();
+  const ssize_t numRead = compressor ?
+    compressor->read(&plain[0], want) : ::read(fd, &plain[0], want);
+  attest(numRead >= 0, "read(%d,%%p,%zu) failed: %m", fd, want);
+  if (numRead > 0)
+  {
+    // encrypt a slice at a time, hashing the previous slice meanwhile
+    size_t len = 0;
+    for (ssize_t off = 0; off < numRead; off += SLICE_SIZE)
     {
-      close(fd);
-      fd = -1;
-      eof=true;
+      const size_t num = encrypter.update(
+        &plain[off], std::min(numRead - off, SLICE_SIZE), out + len);
+      hasher.update(out + len, num);
+      len += num;
     }
-    if (eof)
+    // out belongs to the caller (or gets re-used) from here on
+    hasher.wait();
+
+    // segment complete? start the next one with a new key
+    segmentFill += numRead;
+    if (segmentSize && (segmentFill == segmentSize))
     {
+      len += finishSegment(out + len);
+      ++segment;
+      encrypter.rekey();
+      digest.reset();
+      startSegment();
+    }
+    return len;
+  }
 
-      std::string enc = encrypter.final();
-      digest.update(enc);
-      cache += enc;
+  // the compressor has already closed it
+  if (!compressor)
+  {
+    close(fd);
+  }
+  fd = -1;
+  eof = true;
 
-      // now get the hash calculated for the ciphertext
-      std::string hash = digest.final();
+  return finishSegment(out);
+}
 
-      // XOR it with the key and append
-      enc = Xor(encrypter.getIV() + encrypter.getKey(), hash);
-      cache += enc;
+/**
+ * @brief read up to len bytes of ciphertext
+ *
+ * @return number of bytes read, 0 on EOF
+ */
+ssize_t EncryptingReader::read(void * pBuff, const ssize_t len)
+{
+  uint8_t * out = static_cast<uint8_t *>(pBuff);
+  // top up the cache if it's empty
+  while (head == tail)
+  {
+    if (eof || (len <= 0))
+    {
+      return 0;
+    }
+    // room for a whole chunk? then skip the cache.
+    if (static_cast<size_t>(len) >= cache.size())
+    {
+      const size_t ret = encryptChunk(out);
+      if (ret)
+      {
+        return ret;
+      }
       continue;
     }
-    // encrypt the block ...
-    std::string enc = encrypter.update(buff);
-    // ... and update the hash
-    digest.update(enc);
-    cache += enc;
+    head = 0;
+    tail = encryptChunk(&cache[0]);
   }
   // calculate how much will be returned
-  ssize_t ret = std::min(static_cast<ssize_t>(cache.length()), len);
-  memcpy(pBuff, cache.c_str(), ret);
-  cache = cache.substr(ret);
+  const size_t ret = std::min(tail - head, static_cast<size_t>(len));
+  memcpy(out, &cache[head], ret);
+  head += ret;
+  return ret;
+}
+
+ssize_t EncryptingReader::readFully(void * pBuff, const ssize_t len)
+{
+  uint8_t * out = static_cast<uint8_t *>(pBuff);
+  // keep reading until we either have enough or there's no more to
+  ssize_t ret = 0;
+  while (ret < len)
+  {
+    const ssize_t numRead = read(out + ret, len - ret);
+    if (numRead == 0)
+    {
+      break;
+    }
+    ret += numRead;
+  }
   return ret;
 };
 
@@ -553,23 +1387,22 @@ static void encrypt(int fdIn,
                     int fdOut,
                     const EVP_MD      * md,
                     const EVP_CIPHER  * cipher,
-                    ENGINE            * engine)
+                    ENGINE            * engine,
+                    const PackageOptions & options)
 {
-  EncryptingReader rdr(fdIn, md, cipher, engine);
+  EncryptingReader rdr(fdIn, md, cipher, engine, options);
 
-  char buff[4096];
+  std::vector<uint8_t> buff(rdr.chunkSize());
   while(1)
   {
-    const ssize_t numRead = rdr.readFully(buff, sizeof(buff));
+    const ssize_t numRead = rdr.read(&buff[0], buff.size());
     if (numRead == 0)
     {
       close(fdOut);
       return;
     }
     attest(numRead > 0, "read error: %m");
-    const ssize_t numWritten = write(fdOut, buff, numRead);
-    attest(numWritten == numRead, "write error (%zd != %zd): %m",
-           numWritten, numRead);
+    writeFully(fdOut, &buff[0], numRead);
   }
 }
 
@@ -577,32 +1410,35 @@ void encrypt(int fdIn,
              const std::string & encrypted,
              const EVP_MD      * md,
              const EVP_CIPHER  * cipher,
-             ENGINE            * engine)
+             ENGINE            * engine,
+             const PackageOptions & options)
 {
   int fdOut = open(encrypted.c_str(),
                     O_WRONLY | O_CREAT | O_TRUNC,
                    S_IRUSR | S_IWUSR);
   attest(fdOut != -1, "open(%s, WRONLY): %m", encrypted.c_str());
 
-  encrypt(fdIn, fdOut, md, cipher, engine);
+  encrypt(fdIn, fdOut, md, cipher, engine, options);
 }
 
 void encrypt(const std::string & plaintext,
              const std::string & encrypted,
              const EVP_MD      * md,
              const EVP_CIPHER  * cipher,
-             ENGINE            * engine)
+             ENGINE            * engine,
+             const PackageOptions & options)
 {
   // open the file to decrypt
   int fdIn = open(plaintext.c_str(), O_RDONLY);
   attest(fdIn != -1, "open(%s, RDONLY): %m", plaintext.c_str());
 
-  encrypt(fdIn, encrypted, md, cipher, engine);
+  encrypt(fdIn, encrypted, md, cipher, engine, options);
 }
 
 void encrypt(const EVP_MD      * md,
              const EVP_CIPHER  * cipher,
-             ENGINE            * engine)
+             ENGINE            * engine,
+             const PackageOptions & options)
 {
-  encrypt(STDIN_FILENO, STDOUT_FILENO, md, cipher, engine);
+  encrypt(STDIN_FILENO, STDOUT_FILENO, md, cipher, engine, options);
 }
@@ -1,10 +1,49 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 // OPENSSL_USER_MACROS(7SSL)
 #define OPENSSL_NO_DEPRECATED
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <zlib.h>
+
+/// package header, only present if the package doesn't use the
+/// default digest and cipher or is segmented. Included in the package hash.
+typedef struct
+{
+  char     magic[8];
+  uint8_t  version;
+  uint8_t  flags;
+  uint16_t cipher;      // NID, big-endian
+  uint16_t digest;      // NID, big-endian
+  uint8_t  segmentPo2;  // 0: single package
+  uint8_t  reserved;
+}__attribute__ ((aligned(1), packed)) packageHeader;
+
+/// packageHeader.flags: plaintext was deflate()d before encryption
+const uint8_t PACKAGE_ZLIB = 0x01;
+
+/// optional package features, the defaults are readable by all versions
+struct PackageOptions
+{
+  /// split into independent packages of this many bytes of plaintext
+  /// (a power of 2), 0 for a single package
+  size_t segmentSize = 0;
+  /// zlib compression level (1 - 9) applied before encryption, 0 for none
+  int    compression = 0;
+};
+
+/// smallest and largest segments, decrypting buffers a whole segment
+const uint8_t MIN_SEGMENT_Po2 = 16;
+const uint8_t MAX_SEGMENT_Po2 = 30;
 
 /// decrypt
 void decrypt(const std::string & encrypted,
@@ -12,22 +51,41 @@ void decrypt(const std::string & encrypted,
              const EVP_MD      * md = nullptr,
              const EVP_CIPHER  * cipher = nullptr,
              ENGINE            * engine = nullptr);
+// decrypt to the given (already open) file descriptor, e.g. STDOUT
+void decrypt(const std::string & encrypted,
+             int fdOut,
+             const EVP_MD      * md = nullptr,
+             const EVP_CIPHER  * cipher = nullptr,
+             ENGINE            * engine = nullptr);
+// decrypt between (already open) file descriptors, fdIn need only be
+// seekable for single packages
+void decrypt(int fdIn,
+             int fdOut,
+             const EVP_MD      * md = nullptr,
+             const EVP_CIPHER  * cipher = nullptr,
+             ENGINE            * engine = nullptr);
+// does a package starting with the len bytes at start say it's
+// segmented, and so can be decrypted in a single pass from a pipe?
+bool isSegmented(const void * start, size_t len);
 // encrypt
 void encrypt(const std::string & plaintext,
              const std::string & encrypted,
              const EVP_MD      * md = nullptr,
              const EVP_CIPHER  * cipher = nullptr,
-             ENGINE            * engine = nullptr);
+             ENGINE            * engine = nullptr,
+             const PackageOptions & options = PackageOptions());
 // encrypt given file descriptor to given file
 void encrypt(int fdIn,
              const std::string & encrypted,
              const EVP_MD      * md = nullptr,
              const EVP_CIPHER  * cipher = nullptr,
-             ENGINE            * engine = nullptr);
+             ENGINE            * engine = nullptr,
+             const PackageOptions & options = PackageOptions());
 // encrypt STDIN to STDOUT
 void encrypt(const EVP_MD      * md = nullptr,
              const EVP_CIPHER  * cipher = nullptr,
-             ENGINE            * engine = nullptr);
+             ENGINE            * engine = nullptr,
+             const PackageOptions & options = PackageOptions());
 
 // forward declatarion to allow friend-ing.
 class Digest2;
@@ -40,14 +98,17 @@ public:
   virtual ~Digest();
   void update(const std::string & buff);
   void update(const void * buff, size_t len);
-  virtual std::string final();
+  std::string final();
+  virtual size_t final(void * out);
   std::string final(const std::string & buff);
   std::string final(const void * buff, size_t len);
   virtual void reset();
   size_t length();
+  int nid();
 
 private:
   void Create();
+  void Init();
   void Destroy();
   EVP_MD_CTX   * ctx;
   const EVP_MD * type;
@@ -60,10 +121,45 @@ class Digest2 : public Digest
 {
 public:
   Digest2(const EVP_MD * _type, ENGINE * _impl);
-  virtual std::string final() override;
+  using Digest::final;
+  size_t final(void * out) override;
   void reset() override;
 };
 
+/// digest buffers, in order, on a background thread
+class DigestThread
+{
+public:
+  DigestThread(Digest & _digest);
+  virtual ~DigestThread();
+  void update(const void * buff, size_t len);
+  void wait();
+private:
+  void run();
+  void await(const std::function<bool()> & ready);
+  void wake();
+  // buffers queued for digesting
+  struct item
+  {
+    const void * buff;
+    size_t       len;
+  };
+  static const size_t SLOTS = 64;
+  item queue[SLOTS];
+  // single producer (head), single consumer (tail)
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+  std::atomic<bool>   done;
+  // for a side that's given up spinning to sleep on
+  std::mutex               mutex;
+  std::condition_variable  cv;
+  std::atomic<unsigned>    sleepers;
+  Digest            & digest;
+  // what digest.update() threw, set before tail moves past it
+  std::exception_ptr  thrown;
+  std::thread         thread;
+};
+
 class Cipher
 {
 public:
@@ -71,6 +167,8 @@ public:
   virtual ~Cipher();
   size_t keyLength();
   size_t ivLength();
+  size_t blockSize();
+  int nid();
 
 protected:
   EVP_CIPHER_CTX   * ctx;
@@ -87,25 +185,94 @@ public:
   const std::string & getKey();
   const std::string & getIV();
   std::string update(const std::string & buff);
+  size_t update(const void * buff, size_t len, void * out);
   std::string final();
+  size_t final(void * out);
+  void rekey();
 private:
+  void init();
   std::string key;
   std::string iv;
 };
 
+/// Decryptor
+class Decrypter : public Cipher
+{
+public:
+  Decrypter(const std::string & key,
+            const std::string & iv,
+            const EVP_CIPHER *_type,
+            ENGINE *_impl);
+  Decrypter(const std::string & keyAndIV,
+            const EVP_CIPHER *_type,
+            ENGINE *_impl);
+  Decrypter(const EVP_CIPHER *_type,
+            ENGINE *_impl);
+  virtual ~Decrypter();
+  std::string update(const std::string & buff);
+  size_t update(const void * buff, size_t len, void * out);
+  std::string final();
+  size_t final(void * out);
+  void rekey(const void * keyAndIV);
+private:
+  void init(const void * key, const void * iv);
+};
+
+/// read from the given file descriptor, compressing along the way
+class CompressingReader
+{
+public:
+  CompressingReader(const int _fd, const int level, const size_t readSize);
+  virtual ~CompressingReader();
+  size_t read(void * pBuff, const size_t len);
+private:
+  int  fd;
+  bool eof;
+  bool done;
+  std::vector<uint8_t> in;
+  z_stream strm;
+};
+
+/// default number of plaintext bytes read (and encrypted) at a time
+const size_t DEFAULT_READ_SIZE = 1 << 20;
+
+/// granularity at which encryption and hashing overlap
+const ssize_t SLICE_SIZE = 64 << 10;
+
 /// read from given file descryptor, encrpting along the way
 class EncryptingReader
 {
 public:
   EncryptingReader(const int _fd,
-                   const EVP_MD     * md     = nullptr,
-                   const EVP_CIPHER * cipher = nullptr,
-                   ENGINE           * engine = nullptr);
+                   const EVP_MD     * md       = nullptr,
+                   const EVP_CIPHER * cipher   = nullptr,
+                   ENGINE           * engine   = nullptr,
+                   const PackageOptions & options = PackageOptions(),
+                   const size_t       readSize = DEFAULT_READ_SIZE);
+  ssize_t read(void * pBuff, const ssize_t len);
   ssize_t readFully(void * pBuff, const ssize_t len);
+  size_t  chunkSize() const;
 private:
+  size_t encryptChunk(uint8_t * out);
+  void   startSegment();
+  size_t finishSegment(uint8_t * out);
   int fd;
   bool eof;
-  std::string cache;
+  packageHeader header;
+  size_t        headerLen;
+  // segmented packages only
+  size_t        segmentSize;
+  size_t        segmentFill;
+  uint64_t      segment;
+  // plaintext is read into here ...
+  std::vector<uint8_t> plain;
+  // ... and ciphertext that didn't fit the caller's buffer waits here.
+  std::vector<uint8_t> cache;
+  size_t head;
+  size_t tail;
   Digest2      digest;
-  Encrypter   encrypter;
+  Encrypter    encrypter;
+  DigestThread hasher;
+  // only if compressing
+  std::unique_ptr<CompressingReader> compressor;
 };
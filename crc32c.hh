@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// CRC-32C (Castagnoli), as used by iSCSI, ext4, btrfs etc.
+// uses the SSE4.2 crc32 instruction if the CPU has it, otherwise
+// a lookup table.
+class CRC32C
+{
+public:
+  CRC32C()
+    {
+      for (uint32_t idx = 0; idx < 256; ++idx)
+      {
+        uint32_t crc = idx;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+          crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+        }
+        table[idx] = crc;
+      }
+#if defined(__x86_64__) && defined(__GNUC__)
+      hw = __builtin_cpu_supports("sse4.2");
+#endif  // __x86_64__ && __GNUC__
+    }
+
+  // checksum of a buffer
+  uint32_t operator()(const void * buff, size_t len) const
+    {
+#if defined(__x86_64__) && defined(__GNUC__)
+      if (hw)
+      {
+        return hardware((const uint8_t *)buff, len);
+      }
+#endif  // __x86_64__ && __GNUC__
+      const uint8_t * p = (const uint8_t *)buff;
+      uint32_t crc = ~0U;
+      while (len--)
+      {
+        crc = (crc >> 8) ^ table[(crc ^ *p++) & 0xFF];
+      }
+      return ~crc;
+    }
+
+  // built-in test
+  void BIT() const
+    {
+      // the standard check value
+      attest((*this)("123456789", 9) == 0xE3069283, "CRC32C check failed");
+    }
+
+private:
+#if defined(__x86_64__) && defined(__GNUC__)
+  __attribute__((target("sse4.2")))
+  static uint32_t hardware(const uint8_t * p, size_t len)
+    {
+      uint64_t crc = ~0U;
+      for (; len >= 8; p += 8, len -= 8)
+      {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = __builtin_ia32_crc32di(crc, word);
+      }
+      while (len--)
+      {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+      }
+      return ~(uint32_t)crc;
+    }
+
+  bool hw = false;
+#endif  // __x86_64__ && __GNUC__
+
+  // reflected polynomial
+  static const uint32_t poly = 0x82F63B78;
+  uint32_t table[256];
+};
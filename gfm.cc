@@ -1,12 +1,29 @@
 #include "slss.hh"
+#include "crc32c.hh"
 #include "gfa.hh"
+#include "gfm.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <chrono>
+#include <condition_variable>
+#include <dirent.h>
+#include <endian.h>
 #include <errno.h>
+#include <exception>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <limits.h>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <openssl/evp.h>
+#include <set>
 #include <sstream>
 #include <stdarg.h>
 #include <stdint.h>
@@ -14,15 +31,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 extern const char _binary_slss_tar_start;
 extern const char _binary_slss_tar_end;
 
 std::ofstream dumpFile;
 
+// before _binary_slss_tar_len, blobSize() tests it
+static const CRC32C crc32c;
+
 static size_t blobSize();
 static size_t _binary_slss_tar_len = blobSize();
 
@@ -33,6 +56,72 @@ static size_t _binary_slss_tar_len = blobSize();
 static const uint8_t BLOCKSIZE_Po2 = 10;
 static const size_t  BLOCKSIZE     = 1 << BLOCKSIZE_Po2;
 
+/// set in signature.blocksizePo2 if every block of the share is
+/// followed by its CRC32C (little-endian)
+static const uint8_t BLOCK_CRC = 0x80;
+static const size_t  CRC_SIZE  = sizeof(uint32_t);
+
+/**
+   A std::thread that keeps what it throws (attest() throws) for join()
+   to rethrow, rather than terminating the process.
+*/
+class Thread
+{
+public:
+  explicit Thread(const std::function<void()> & body)
+    : error(std::make_shared<std::exception_ptr>())
+    , thread([body, thrown = error]()
+      {
+        try
+        {
+          body();
+        }
+        catch (...)
+        {
+          *thrown = std::current_exception();
+        }
+      })
+    {
+    }
+
+  void join()
+    {
+      thread.join();
+      if (*error)
+      {
+        std::rethrow_exception(*error);
+      }
+    }
+
+private:
+  std::shared_ptr<std::exception_ptr> error;
+  std::thread thread;
+};
+
+/// join all the threads, then rethrow the first thing any of them threw
+static void JoinAll(std::vector<Thread> & threads)
+{
+  std::exception_ptr first;
+  for (Thread & thread : threads)
+  {
+    try
+    {
+      thread.join();
+    }
+    catch (...)
+    {
+      if (!first)
+      {
+        first = std::current_exception();
+      }
+    }
+  }
+  if (first)
+  {
+    std::rethrow_exception(first);
+  }
+}
+
 // Signature prepended to data and parity files.
 typedef struct
 {
@@ -59,6 +148,7 @@ public:
 
       // create an array to calculate the parity
       d = makeArray(rows, numData + 1);
+      scale.assign(rows, 1);
 /*
   NEW AND IMPROVED
   based on original and updated papers
@@ -133,6 +223,7 @@ public:
           {
             d[row][col] = gfa.mult(inv,d[row][col]);
           }
+          scale[row] = inv;
 //                    print("scaled...");
         }
         // now zero-out the other columns
@@ -228,6 +319,20 @@ public:
       }
     }
 
+  // calculate a single parity row for a whole block of data
+  //  data [0..len-1][0..numData-1] and data[row]
+  inline void parity(uint8_t ** data, size_t len, const uint8_t row)
+    {
+      memset(data[row], 0, len);
+      for (int col = 0; col < numData; ++col)
+      {
+        for (size_t idx = 0; idx < len; ++idx)
+        {
+          data[row][idx] ^= gfa.mult(data[col][idx], d[row][col]);
+        }
+      }
+    }
+
   // calculate the parity for a single block of data
   inline void parity(uint8_t * data)
     {
@@ -246,6 +351,12 @@ public:
       }
     }
 
+  // number of rows, data and parity
+  int rows() const
+    {
+      return numData + numParity;
+    }
+
   // mark a data (or parity) set as failed.
   void failData(const uint8_t idx)
     {
@@ -464,6 +575,197 @@ public:
       }
     }
 
+  // Find the rows of a stripe that don't agree with the rest, using
+  // the rows available beyond the numData needed. Bar the scaled rows,
+  // the Vandermonde rows only had column operations applied, so the
+  // code is still Reed-Solomon: row i is scale[i] times the data's
+  // polynomial evaluated at i. With w[i] = 1 / prod(i - l) over the
+  // other available rows l,
+  //   sum(w[i] * i^j * rows[i] / scale[i]) == 0
+  // for j < (available - numData).
+  // These "syndromes" are all zero for a consistent stripe. If not,
+  // each byte's syndromes are a linear recurrence whose roots are the
+  // bad rows, found with Berlekamp-Massey, so up to half the surplus
+  // rows can be bad in each byte without trying every combination.
+  // rows[idx] is nullptr if row idx isn't available. Sets bad[idx]
+  // for the bad rows, returns false if there are too many to tell.
+  bool locate(uint8_t * const * rows,
+              const size_t len,
+              std::vector<bool> & bad) const
+    {
+      const int numRows = numData + numParity;
+      bad.assign(numRows, false);
+      int numChecks = 0;
+      uint8_t ** syn = syndromes(rows, len, numChecks);
+      if (!syn)
+      {
+        return true;
+      }
+
+      bool ret = true;
+      std::vector<uint8_t> s(numChecks);
+      std::vector<uint8_t> c(numChecks + 1);
+      std::vector<uint8_t> b(numChecks + 1);
+      std::vector<uint8_t> t;
+      for (size_t idx = 0; ret && (idx < len); ++idx)
+      {
+        bool zero = true;
+        for (int j = 0; j < numChecks; ++j)
+        {
+          s[j] = syn[j][idx];
+          zero &= !s[j];
+        }
+        if (zero)
+        {
+          continue;
+        }
+        // Berlekamp-Massey, the shortest recurrence
+        //   s[n] = sum(c[i] * s[n - i]) for 0 < i <= numBad
+        std::fill(c.begin(), c.end(), 0);
+        std::fill(b.begin(), b.end(), 0);
+        c[0] = b[0] = 1;
+        int numBad = 0;
+        int shift = 1;
+        uint8_t last = 1;
+        for (int n = 0; n < numChecks; ++n)
+        {
+          uint8_t diff = s[n];
+          for (int i = 1; i <= numBad; ++i)
+          {
+            diff ^= gfa.mult(c[i], s[n - i]);
+          }
+          if (!diff)
+          {
+            ++shift;
+            continue;
+          }
+          t = c;
+          const uint8_t mult = gfa.div(diff, last);
+          for (int i = 0; (i + shift) <= numChecks; ++i)
+          {
+            c[i + shift] ^= gfa.mult(mult, b[i]);
+          }
+          if ((2 * numBad) > n)
+          {
+            ++shift;
+            continue;
+          }
+          numBad = n + 1 - numBad;
+          b.swap(t);
+          last  = diff;
+          shift = 1;
+        }
+        // the bad rows are the roots of z^numBad * c(1/z), there must
+        // be one for each
+        int numRoots = 0;
+        for (int row = 0; (row < numRows) && ((2 * numBad) <= numChecks); ++row)
+        {
+          if (!rows[row])
+          {
+            continue;
+          }
+          uint8_t val = 0;
+          for (int i = 0; i <= numBad; ++i)
+          {
+            val = gfa.mult(val, row) ^ c[i];
+          }
+          if (!val)
+          {
+            bad[row] = true;
+            ++numRoots;
+          }
+        }
+        ret = (numRoots == numBad);
+      }
+      free(syn);
+      if (!ret)
+      {
+        bad.assign(numRows, false);
+        return false;
+      }
+
+      // the rest must be enough, and agree with each other
+      std::vector<uint8_t *> good(rows, rows + numRows);
+      for (int row = 0; row < numRows; ++row)
+      {
+        if (bad[row])
+        {
+          good[row] = nullptr;
+        }
+      }
+      if (std::count_if(good.begin(), good.end(),
+                        [](const uint8_t * row) { return row; }) < numData)
+      {
+        bad.assign(numRows, false);
+        return false;
+      }
+      syn = syndromes(good.data(), len, numChecks);
+      const bool agree = !syn;
+      free(syn);
+      if (!agree)
+      {
+        bad.assign(numRows, false);
+      }
+      return agree;
+    }
+
+  // calculate the syndromes of the available rows (see locate()),
+  // returning them, or nullptr if they're all zero
+  uint8_t ** syndromes(uint8_t * const * rows,
+                       const size_t len,
+                       int & numChecks) const
+    {
+      const int numRows = numData + numParity;
+      std::vector<int> avail;
+      for (int row = 0; row < numRows; ++row)
+      {
+        if (rows[row])
+        {
+          avail.push_back(row);
+        }
+      }
+      numChecks = (int)avail.size() - numData;
+      if (numChecks <= 0)
+      {
+        return nullptr;
+      }
+      uint8_t ** syn = makeArray(numChecks, len);
+      for (const int row : avail)
+      {
+        // w[row] ...
+        uint8_t w = 1;
+        for (const int other : avail)
+        {
+          if (other != row)
+          {
+            w = gfa.mult(w, row ^ other);
+          }
+        }
+        w = gfa.div(1, gfa.mult(w, scale[row]));
+        // ... times row^j
+        for (int j = 0; j < numChecks; ++j)
+        {
+          for (size_t idx = 0; idx < len; ++idx)
+          {
+            syn[j][idx] ^= gfa.mult(w, rows[row][idx]);
+          }
+          w = gfa.mult(w, row);
+        }
+      }
+      for (int j = 0; j < numChecks; ++j)
+      {
+        for (size_t idx = 0; idx < len; ++idx)
+        {
+          if (syn[j][idx])
+          {
+            return syn;
+          }
+        }
+      }
+      free(syn);
+      return nullptr;
+    }
+
   // helper function for recovery matrix creation
   void MulyRowBy(uint8_t ** m, const uint8_t row, const uint8_t mult)
     {
@@ -484,11 +786,20 @@ public:
     }
 
 private:
-  GFA        gfa;
+  // the arithmetic tables are the same for every matrix, so they're
+  // built once and shared
+  static const GFA & Field()
+    {
+      static const GFA field;
+      return field;
+    }
+
+  const GFA & gfa = Field();
   uint8_t ** d;
   const uint8_t numData;
   const uint8_t numParity;
-
+  // what each row of the Vandermonde matrix was scaled by
+  std::vector<uint8_t> scale;
 
 public:
   // built-in test
@@ -555,12 +866,62 @@ public:
       free(r);
       free(data2);
     };
+
+  // built-in test of locate(), too slow to run on every start
+  static void LocateBIT()
+    {
+      const uint8_t numData   = 25;
+      const uint8_t numParity = 25;
+
+      GFM gfm(numData, numParity);
+      uint8_t ** data2 = gfm.makeArray(numData + numParity, BLOCKSIZE);
+      for (uint8_t rowIdx = 0; rowIdx < numData; ++rowIdx)
+      {
+        uint8_t * row = data2[rowIdx];
+        for (size_t idx = 0; idx < BLOCKSIZE; ++idx)
+        {
+          row[idx] = (uint8_t)(idx * (rowIdx^idx));
+        }
+      }
+      gfm.parity(data2, BLOCKSIZE);
+
+      // corrupt some rows, including row 0 (evaluated at 0), and
+      // lose another
+      std::vector<uint8_t *> rows(data2, data2 + numData + numParity);
+      std::vector<bool> bad;
+      attest(gfm.locate(rows.data(), BLOCKSIZE, bad) &&
+             (std::count(bad.begin(), bad.end(), true) == 0),
+             "consistent rows located as bad");
+      data2[0][7]    ^= 1;
+      data2[3][7]    ^= 0x55;
+      data2[3][100]  ^= 0xAA;
+      data2[30][999] ^= 0xFF;
+      rows[40] = nullptr;
+      attest(gfm.locate(rows.data(), BLOCKSIZE, bad) &&
+             (std::count(bad.begin(), bad.end(), true) == 3) &&
+             bad[0] && bad[3] && bad[30],
+             "bad rows not located");
+
+      free(data2);
+    };
 };
 
+/**
+   Run all the built-in tests, including those too slow to run every
+   time the library is loaded.
+*/
+void SelfTest()
+{
+  GFM::BIT();
+  GFM::LocateBIT();
+  crc32c.BIT();
+}
+
 // extract un-padded file size from v7-format tarball
 size_t blobSize()
 {
   GFM::BIT();
+  crc32c.BIT();
   static_assert(sizeof(signature) == 4, "Signature block should be 4 bytes");
 
   const size_t rawSize =
@@ -595,32 +956,17 @@ std::string MakeFilename(const std::string & stub, const int num)
   return o.str();
 }
 
-void writeHeader(const int fd, const signature & sig, EVP_MD_CTX & ctx)
+// append the start of a share, up to its first block: the tar-blob,
+// the signature and padding
+static void AppendHeader(std::vector<uint8_t> & share, const signature & sig)
 {
-  attest(write(fd,&_binary_slss_tar_start,
-               _binary_slss_tar_len) == (ssize_t)_binary_slss_tar_len,
-         "Unable to write tarball");
-  EVP_DigestUpdate(&ctx, &_binary_slss_tar_start,
-                   _binary_slss_tar_len);
-
-  attest(write(fd,&sig, sizeof(sig))
-         == (ssize_t)sizeof(sig),
-         "Unable to write signature");
-  EVP_DigestUpdate(&ctx, &sig, sizeof(sig));
-
-  static ssize_t len = 0;
-  static char  * pad = 0;
-  if (!pad)
-  {
-    len  = _binary_slss_tar_len + sizeof(sig) + BLOCKSIZE - 1;
-    len &= ~(BLOCKSIZE - 1);
-    len -= _binary_slss_tar_len + sizeof(sig);
-    pad  = (char*)calloc(len,1);
-    attest(pad, "unable to calloc pad");
-  }
-  attest(write(fd,pad, len) == len,
-         "Unable to write pad");
-  EVP_DigestUpdate(&ctx, pad, len);
+  const uint8_t * tar = (const uint8_t *)&_binary_slss_tar_start;
+  share.insert(share.end(), tar, tar + _binary_slss_tar_len);
+  share.insert(share.end(),
+               (const uint8_t *)&sig, (const uint8_t *)&sig + sizeof(sig));
+  const size_t len = _binary_slss_tar_len + sizeof(sig);
+  share.resize(share.size() +
+               (((len + BLOCKSIZE - 1) & ~(BLOCKSIZE - 1)) - len), 0);
 }
 
 ssize_t readFully(const int fd, void * buff, const ssize_t len)
@@ -644,375 +990,3621 @@ ssize_t readFully(const int fd, void * buff, const ssize_t len)
   return (rc < 0) ? rc : prev;
 }
 
-void addPadding(uint8_t * buff, const ssize_t numRead, ssize_t expected)
+void writeFully(const int fd, const void * buff, size_t len)
 {
-  // is the buffer full?
-  if (numRead == expected)
+  const uint8_t * p = (const uint8_t *)buff;
+  while (len)
   {
-    // no need to add padding!
-    buff[expected] = 0;
-    return;
+    const ssize_t rc = write(fd, p, len);
+    attest(rc > 0, "Expected to write %zu, wrote %zd: %m", len, rc);
+    p   += rc;
+    len -= rc;
   }
-  // how many bytes are missing?
-  const ssize_t missing = (expected - numRead);
-  // sanity check.....
-  attest(missing > 0, "no room for padding: %zd <= %zd", expected, numRead);
+}
 
-  // flag the block as being short
-  // missing fewer than 0x80 (128) bytes?
-  if (missing < 0x80)
+// bytes per block in the shares, including any CRC
+static size_t RecordSize(const bool crc)
+{
+  return BLOCKSIZE + (crc ? CRC_SIZE : 0);
+}
+
+// like readFully(), but at off (if not negative) and leaving fd open
+static ssize_t readFully(const int fd,
+                         void * buff,
+                         const ssize_t len,
+                         const off_t off)
+{
+  ssize_t prev = 0;
+  while (prev < len)
   {
-    // just use the last byte to store the shortfall
-    buff[expected] = (uint8_t)(missing & 0xFF);
-    return;
+    char * p = ((char*)buff) + prev;
+    const ssize_t rc = (off < 0) ? read(fd, p, len - prev) :
+      pread(fd, p, len - prev, off + prev);
+    if (rc <= 0)
+    {
+      return (rc < 0) ? rc : prev;
+    }
+    prev += rc;
   }
-  // use a 32-bit int to store the shortfall
-  buff[expected--] = 0x80;
-  uint32_t * buff32 = (uint32_t *)buff;
-  buff32[(expected/4)-2] = missing;
+  return prev;
 }
 
-size_t removePadding(const uint8_t * buff, size_t buffSize)
+// skip len bytes of fd, reading through them if it can't seek
+static bool SkipFully(const int fd, off_t len)
 {
-  attest(buffSize > 0, "cannot remove padding from empty block");
-  uint8_t flag = buff[--buffSize];
-  // block full?
-  if (flag == 0)
+  if (!len || (lseek(fd, len, SEEK_CUR) >= 0))
   {
-    // no padding to remove
-    return buffSize;
+    return true;
   }
-
-  // block missing < 128 bytes?
-  if (flag < 0x80)
+  std::vector<uint8_t> buff(std::min(len, (off_t)1 << 20));
+  while (len)
   {
-    return buffSize - flag;
+    const ssize_t rc = readFully(fd, buff.data(),
+                                 std::min(len, (off_t)buff.size()), -1);
+    if (rc <= 0)
+    {
+      return false;
+    }
+    len -= rc;
   }
-
-  // missing lots!
-  const uint32_t * buff32 = (uint32_t *)buff;
-  const uint32_t missing = buff32[(buffSize/4)-2];
-  buffSize -= missing;
-  return buffSize;
+  return true;
 }
 
-std::string StripDir(const std::string & filename)
-{
-  const size_t found = filename.find_last_of("/\\");
-  // make sure fn doesn't get gc'ed while fn.c_str is in use!
-  return filename.substr(found+1);
-}
+/**
+   Read up to numBlocks blocks from a share into row, returning the
+   number read. With crc each block is followed by its CRC32C, blocks
+   that don't match it are flagged in bad[]. Reads from off if it
+   isn't negative, otherwise from the current position.
 
-// print out the MD checksums
-void PrintMD(FILE * file,
-             const std::string & filename,
-             EVP_MD_CTX *& ctx)
-{
-  unsigned char digest[EVP_MAX_MD_SIZE];
-  unsigned int  digestLen = sizeof(digest);
-  EVP_DigestFinal_ex(ctx, digest, &digestLen);
+   A read error or partial block is fatal, unless failed is given: it
+   is then set and the number of whole blocks read returned.
 
-  for (unsigned i = 0; i < digestLen; ++i)
+   Whatever is read is added to ctx, if given.
+*/
+size_t ReadBlocks(const int fd,
+                  uint8_t * row,
+                  const size_t numBlocks,
+                  const bool crc,
+                  uint8_t * bad,
+                  const off_t off = -1,
+                  bool * failed = nullptr,
+                  EVP_MD_CTX * ctx = nullptr)
+{
+  const size_t recordSize = RecordSize(crc);
+  static thread_local std::vector<uint8_t> raw;
+  if (crc)
   {
-    fprintf(file, "%02x", (digest[i] & 0xFF));
+    raw.resize(numBlocks * recordSize);
+  }
+  const ssize_t rc = readFully(fd, crc ? raw.data() : row,
+                               numBlocks * recordSize, off);
+  const bool ok = (rc >= 0) && !(rc % recordSize);
+  attest(ok || failed, "share is truncated");
+  if (ctx && (rc > 0))
+  {
+    EVP_DigestUpdate(ctx, crc ? raw.data() : row, rc);
+  }
+  if (failed)
+  {
+    *failed = !ok;
+  }
+  const size_t ret = std::max(rc, (ssize_t)0) / recordSize;
+  if (!crc)
+  {
+    memset(bad, 0, ret);
+    return ret;
   }
-  // make sure fn doesn't get gc'ed while fn.c_str is in use!
-  std::string fn = StripDir(filename);
-  fprintf(file, "  %s\n", fn.c_str());
 
-  EVP_MD_CTX_destroy(ctx);
-  ctx = nullptr;
+  for (size_t idx = 0; idx < ret; ++idx)
+  {
+    const uint8_t * record = &raw[idx * recordSize];
+    uint32_t check;
+    memcpy(&check, record + BLOCKSIZE, CRC_SIZE);
+    memcpy(row + (idx * BLOCKSIZE), record, BLOCKSIZE);
+    bad[idx] = (crc32c(record, BLOCKSIZE) != le32toh(check));
+  }
+  return ret;
 }
 
-void CreateParity(const uint8_t numData,
-                  const uint8_t numParity,
-                  const std::string & stub)
+/**
+   Write numBlocks blocks of a share, each followed by its CRC32C if
+   crc, also adding them to the share's checksum.
+*/
+void WriteBlocks(const int fd,
+                 const uint8_t * row,
+                 const size_t numBlocks,
+                 const bool crc,
+                 EVP_MD_CTX * ctx)
 {
-  GFM gfm (numData, numParity);
-  int fds[250];//numParity + numData];
-  signature sig =
-    {
-      .numData      = numData,
-      .numParity    = numParity,
-      .fileNum      = 0,
-      .blocksizePo2 = BLOCKSIZE_Po2,
-    };
-  EVP_MD_CTX * MD_ctx[257];
-  std::string filename[257];
-
-  const EVP_MD * EVP_MD5 = EVP_sha256();
-
-  MD_ctx[256] = EVP_MD_CTX_create();
-  attest(MD_ctx[256] != nullptr,
-         "Unable to create payload context");
-  EVP_DigestInit_ex(MD_ctx[256], EVP_MD5, 0);
-  filename[256] = stub + ".sha256";
-  FILE * md5File = fopen(filename[256].c_str(), "w");
-  attest(md5File, "Unable to open MD file: '%s'",
-         filename[256].c_str());
-
-  for (int idx = 0; idx < (numData + numParity); ++idx)
+  if (!crc)
   {
-    filename[idx] = MakeFilename(stub, idx);
-    fds[idx] = open(filename[idx].c_str(),
-                    O_WRONLY | O_CREAT | O_TRUNC,
-                    S_IRUSR | S_IWUSR);
-    attest(fds[idx], "Unable to open file: '%s'",
-           filename[idx].c_str());
-
-    MD_ctx[idx] = EVP_MD_CTX_create();
-    attest(MD_ctx[idx] != nullptr,
-           "Unable to create context for [%d]", idx);
-    EVP_DigestInit_ex(MD_ctx[idx], EVP_MD5, 0);
-
-    sig.fileNum = idx;
-    writeHeader(fds[idx], sig, *MD_ctx[idx]);
-
+    writeFully(fd, row, numBlocks * BLOCKSIZE);
+    EVP_DigestUpdate(ctx, row, numBlocks * BLOCKSIZE);
+    return;
   }
-
-  uint8_t ** buff = GFM::makeArray(numData + numParity, BLOCKSIZE);
-  int fd = open(stub.c_str(), O_RDONLY);
-  attest(fd != -1, "Unable to open \"%s\": %m", stub.c_str());
-
-  while(1)
+  const size_t recordSize = RecordSize(crc);
+  std::vector<uint8_t> raw(numBlocks * recordSize);
+  for (size_t idx = 0; idx < numBlocks; ++idx)
   {
-    memset(buff[0], 0, numData * BLOCKSIZE);
-    ssize_t numRead = readFully(fd, buff[0], (numData * BLOCKSIZE) - 1);
-    addPadding(buff[0], numRead, (numData * BLOCKSIZE) - 1);
-    // calc parity
-    gfm.parity(buff, BLOCKSIZE);
+    uint8_t * record = &raw[idx * recordSize];
+    const uint8_t * block = row + (idx * BLOCKSIZE);
+    const uint32_t check = htole32(crc32c(block, BLOCKSIZE));
+    memcpy(record, block, BLOCKSIZE);
+    memcpy(record + BLOCKSIZE, &check, CRC_SIZE);
+  }
+  writeFully(fd, raw.data(), raw.size());
+  EVP_DigestUpdate(ctx, raw.data(), raw.size());
+}
 
-    EVP_DigestUpdate(MD_ctx[256], buff[0], numRead);
+/**
+   Recovery matrices for each combination of shares used, made as
+   they are first needed. Safe to share between threads.
+*/
+class RecoveryCache
+{
+public:
+  RecoveryCache(const uint8_t _numData, const uint8_t _numParity)
+    : numData(_numData)
+    , numParity(_numParity)
+    {
+    }
+
+  virtual ~RecoveryCache()
+    {
+      for (auto & entry : cache)
+      {
+        free(entry.second);
+      }
+    }
+
+  // recovery matrix for the given shares
+  uint8_t ** operator()(const std::vector<bool> & used)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      uint8_t ** & ret = cache[used];
+      if (!ret)
+      {
+        GFM tmp(numData, numParity);
+        for (int idx = 0; idx < (numData + numParity); ++idx)
+        {
+          if (!used[idx])
+          {
+            tmp.failData(idx);
+          }
+        }
+        ret = tmp.recovery();
+      }
+      return ret;
+    }
+
+private:
+  const uint8_t numData;
+  const uint8_t numParity;
+  std::mutex mutex;
+  std::map<std::vector<bool>, uint8_t **> cache;
+};
+
+// the recovery matrices of the geometry, kept for the life of the
+// process and shared by all the decoders
+static RecoveryCache & SharedRecovery(const uint8_t numData,
+                                      const uint8_t numParity)
+{
+  static std::mutex mutex;
+  static std::map<std::pair<uint8_t, uint8_t>,
+                  std::unique_ptr<RecoveryCache>> caches;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<RecoveryCache> & ret = caches[{numData, numParity}];
+  if (!ret)
+  {
+    ret.reset(new RecoveryCache(numData, numParity));
+  }
+  return *ret;
+}
+
+/**
+   Replaces blocks that fail their CRC32C with ones calculated from
+   the good blocks of the other shares of the stripe, reading the
+   spare shares (open, but not otherwise being read) as needed.
+   Shares being read elsewhere (given as others) are read too when
+   their block isn't given, but aren't closed.
+   Recovery matrices are kept for each combination of shares used.
+*/
+class BlockFixer
+{
+public:
+  BlockFixer(const uint8_t _numData,
+             const uint8_t _numParity,
+             const int * _spares,
+             const int * _others = nullptr)
+    : numData(_numData)
+    , numParity(_numParity)
+    , gfm(_numData, _numParity)
+    , spares(_numData + _numParity, -1)
+    , others(_numData + _numParity, -1)
+    , start(_numData + _numParity, 0)
+    , recovery(_numData, _numParity)
+    {
+      if (_spares)
+      {
+        spares.assign(_spares, _spares + numData + numParity);
+      }
+      if (_others)
+      {
+        others.assign(_others, _others + numData + numParity);
+      }
+      for (size_t idx = 0; idx < spares.size(); ++idx)
+      {
+        if (spares[idx] < 0)
+        {
+          spares[idx] = -1;
+        }
+        const int fd = (spares[idx] >= 0) ? spares[idx] : others[idx];
+        if (fd >= 0)
+        {
+          start[idx] = lseek(fd, 0, SEEK_CUR);
+        }
+      }
+    }
+
+  virtual ~BlockFixer()
+    {
+      for (const int fd : spares)
+      {
+        if (fd >= 0)
+        {
+          close(fd);
+        }
+      }
+    }
+
+  // fix the bad blocks of stripe number "stripe". blocks[idx] is
+  // share idx's block, nullptr if it isn't being read.
+  void fix(const size_t stripe,
+           const std::vector<uint8_t *> & blocks,
+           const std::vector<bool> & bad)
+    {
+      const int numShares = numData + numParity;
+      const size_t recordSize = RecordSize(true);
+      uint8_t ** scratch = GFM::makeArray(numShares, recordSize);
+
+      // the first numData good blocks
+      std::vector<uint8_t *> rows(numShares, nullptr);
+      std::vector<bool> used(numShares, false);
+      int numUsed = 0;
+      for (int idx = 0; (idx < numShares) && (numUsed < numData); ++idx)
+      {
+        if (blocks[idx] && !bad[idx])
+        {
+          rows[idx] = blocks[idx];
+        }
+        else if (!blocks[idx] &&
+                 (std::max(spares[idx], others[idx]) >= 0))
+        {
+          const int fd = std::max(spares[idx], others[idx]);
+          uint32_t check;
+          const off_t off = start[idx] + (stripe * recordSize);
+          if ((pread(fd, scratch[idx], recordSize, off)
+               != (ssize_t)recordSize) ||
+              (memcpy(&check, scratch[idx] + BLOCKSIZE, CRC_SIZE),
+               crc32c(scratch[idx], BLOCKSIZE) != le32toh(check)))
+          {
+            continue;
+          }
+          rows[idx] = scratch[idx];
+        }
+        else
+        {
+          continue;
+        }
+        used[idx] = true;
+        ++numUsed;
+      }
+      attest(numUsed == numData,
+             "stripe %zu: only %d good blocks of the %d needed",
+             stripe, numUsed, (int)numData);
+
+      // recover the data ...
+      for (int idx = 0; idx < numData; ++idx)
+      {
+        if (!used[idx])
+        {
+          rows[idx] = scratch[idx];
+        }
+      }
+      gfm.recover(rows.data(), recovery(used), BLOCKSIZE);
+
+      // ... and from that the bad blocks
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        if (!blocks[idx] || !bad[idx])
+        {
+          continue;
+        }
+        if (idx < numData)
+        {
+          memcpy(blocks[idx], rows[idx], BLOCKSIZE);
+          continue;
+        }
+        rows[idx] = blocks[idx];
+        gfm.parity(rows.data(), BLOCKSIZE, idx);
+      }
+      free(scratch);
+    }
+
+private:
+  const uint8_t numData;
+  const uint8_t numParity;
+  GFM gfm;
+  std::vector<int> spares;
+  std::vector<int> others;
+  std::vector<off_t> start;
+  RecoveryCache recovery;
+};
+
+void addPadding(uint8_t * buff, const ssize_t numRead, ssize_t expected)
+{
+  // is the buffer full?
+  if (numRead == expected)
+  {
+    // no need to add padding!
+    buff[expected] = 0;
+    return;
+  }
+  // how many bytes are missing?
+  const ssize_t missing = (expected - numRead);
+  // sanity check.....
+  attest(missing > 0, "no room for padding: %zd <= %zd", expected, numRead);
+
+  // flag the block as being short
+  // missing fewer than 0x80 (128) bytes?
+  if (missing < 0x80)
+  {
+    // just use the last byte to store the shortfall
+    buff[expected] = (uint8_t)(missing & 0xFF);
+    return;
+  }
+  // use a 32-bit int to store the shortfall
+  buff[expected--] = 0x80;
+  uint32_t * buff32 = (uint32_t *)buff;
+  buff32[(expected/4)-2] = missing;
+}
+
+size_t removePadding(const uint8_t * buff, size_t buffSize)
+{
+  attest(buffSize > 0, "cannot remove padding from empty block");
+  uint8_t flag = buff[--buffSize];
+  // block full?
+  if (flag == 0)
+  {
+    // no padding to remove
+    return buffSize;
+  }
+
+  // block missing < 128 bytes?
+  if (flag < 0x80)
+  {
+    return buffSize - flag;
+  }
+
+  // missing lots!
+  const uint32_t * buff32 = (uint32_t *)buff;
+  const uint32_t missing = buff32[(buffSize/4)-2];
+  buffSize -= missing;
+  return buffSize;
+}
+
+std::string StripDir(const std::string & filename)
+{
+  const size_t found = filename.find_last_of("/\\");
+  // make sure fn doesn't get gc'ed while fn.c_str is in use!
+  return filename.substr(found+1);
+}
+
+// finish an MD checksum as a "sha256sum"-style line
+std::string FormatMD(const std::string & filename,
+                     EVP_MD_CTX *& ctx)
+{
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int  digestLen = sizeof(digest);
+  EVP_DigestFinal_ex(ctx, digest, &digestLen);
+
+  std::ostringstream o;
+  for (unsigned i = 0; i < digestLen; ++i)
+  {
+    o << std::setw(2) << std::setfill('0') << std::hex
+      << (digest[i] & 0xFF);
+  }
+  o << "  " << StripDir(filename) << '\n';
+
+  EVP_MD_CTX_destroy(ctx);
+  ctx = nullptr;
+  return o.str();
+}
+
+// print out the MD checksums
+void PrintMD(FILE * file,
+             const std::string & filename,
+             EVP_MD_CTX *& ctx)
+{
+  fputs(FormatMD(filename, ctx).c_str(), file);
+}
+
+// the lines of the stub's .sha256 manifest, if there is one
+static std::vector<std::string> ReadManifest(const std::string & stub)
+{
+  std::vector<std::string> lines;
+  std::ifstream in(stub + ".sha256");
+  for (std::string line; std::getline(in, line); )
+  {
+    lines.push_back(line + '\n');
+  }
+  return lines;
+}
+
+// the manifest line for the same file as the given one, or end()
+static std::vector<std::string>::iterator
+FindMD(std::vector<std::string> & lines, const std::string & line)
+{
+  const std::string name = line.substr(line.find("  "));
+  return std::find_if(lines.begin(), lines.end(),
+                      [&name](const std::string & l)
+                      { return ends_with(l, name); });
+}
+
+// does the line match the manifest? True if the file isn't in it
+static bool CheckMD(std::vector<std::string> & lines, const std::string & line)
+{
+  const auto it = FindMD(lines, line);
+  return (it == lines.end()) || (*it == line);
+}
+
+struct ShareEncoder::State
+{
+  State(const uint8_t _numData, const uint8_t _numParity, const bool _crc)
+    : numData(_numData)
+    , numParity(_numParity)
+    , crc(_crc)
+    , gfm(_numData, _numParity)
+    , rows(GFM::makeArray(_numData + _numParity, BLOCKSIZE))
+    {
+    }
 
-    const bool last = (numRead != (ssize_t)((numData * BLOCKSIZE)-1));
+  virtual ~State()
+    {
+      free(rows);
+    }
+
+  // start the shares, if they haven't been
+  void start(std::vector<std::vector<uint8_t>> & shares)
+    {
+      shares.resize(numData + numParity);
+      if (started)
+      {
+        return;
+      }
+      signature sig =
+        {
+          .numData      = numData,
+          .numParity    = numParity,
+          .fileNum      = 0,
+          .blocksizePo2 = (uint8_t)(BLOCKSIZE_Po2 | (crc ? BLOCK_CRC : 0)),
+        };
+      for (int idx = 0; idx < (numData + numParity); ++idx)
+      {
+        sig.fileNum = idx;
+        AppendHeader(shares[idx], sig);
+      }
+      started = true;
+    }
+
+  // pad the have bytes of the stripe and append it to the shares
+  void encode(std::vector<std::vector<uint8_t>> & shares)
+    {
+      const size_t want = (numData * BLOCKSIZE) - 1;
+      memset(rows[0] + have, 0, (numData * BLOCKSIZE) - have);
+      addPadding(rows[0], have, want);
+      gfm.parity(rows, BLOCKSIZE);
+      for (int idx = 0; idx < (numData + numParity); ++idx)
+      {
+        std::vector<uint8_t> & share = shares[idx];
+        share.insert(share.end(), rows[idx], rows[idx] + BLOCKSIZE);
+        if (crc)
+        {
+          const uint32_t check = htole32(crc32c(rows[idx], BLOCKSIZE));
+          share.insert(share.end(), (const uint8_t *)&check,
+                       (const uint8_t *)&check + CRC_SIZE);
+        }
+      }
+      have = 0;
+    }
+
+  const uint8_t numData;
+  const uint8_t numParity;
+  const bool crc;
+  GFM gfm;
+  // the stripe being filled, then encoded
+  uint8_t ** rows;
+  // bytes of the stripe filled
+  size_t have = 0;
+  // the shares' headers have been appended
+  bool started = false;
+};
+
+ShareEncoder::ShareEncoder(const uint8_t numData,
+                           const uint8_t numParity,
+                           const bool crc)
+{
+  attest(numData && numParity,
+         "invalid geometry, %u data and %u parity shares",
+         (unsigned)numData, (unsigned)numParity);
+  state.reset(new State(numData, numParity, crc));
+}
+
+ShareEncoder::~ShareEncoder()
+{
+}
+
+void ShareEncoder::update(const void * data,
+                          size_t len,
+                          std::vector<std::vector<uint8_t>> & shares)
+{
+  State & s = *state;
+  s.start(shares);
+  // each stripe holds one byte less than its blocks, for the padding
+  const size_t want = (s.numData * BLOCKSIZE) - 1;
+  const uint8_t * p = (const uint8_t *)data;
+  while (len)
+  {
+    const size_t num = std::min(len, want - s.have);
+    memcpy(s.rows[0] + s.have, p, num);
+    s.have += num;
+    p      += num;
+    len    -= num;
+    if (s.have == want)
+    {
+      s.encode(shares);
+    }
+  }
+}
+
+void ShareEncoder::final(std::vector<std::vector<uint8_t>> & shares)
+{
+  State & s = *state;
+  s.start(shares);
+  // the last stripe is always short, if only by the padding
+  s.encode(shares);
+  s.started = false;
+}
+
+/**
+   Split what can be read from fd into shares of the stub, appending
+   suffix to the names of the files written (but not to those in the
+   .sha256 manifest).
+*/
+std::string SplitShares(const uint8_t numData,
+                        const uint8_t numParity,
+                        const std::string & stub,
+                        const int fd,
+                        const int * fds,
+                        const bool crc,
+                        const std::chrono::milliseconds nap)
+{
+  ShareEncoder encoder(numData, numParity, crc);
+  // a context for each share then the payload, freed if anything throws
+  typedef std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> Context;
+  std::vector<Context> MD_ctx;
+  MD_ctx.reserve(numData + numParity + 1);
+
+  const EVP_MD * EVP_MD5 = EVP_sha256();
+
+  for (int idx = 0; idx <= (numData + numParity); ++idx)
+  {
+    MD_ctx.emplace_back(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    attest(MD_ctx[idx] != nullptr,
+           "Unable to create context for [%d]", idx);
+    EVP_DigestInit_ex(MD_ctx[idx].get(), EVP_MD5, 0);
+  }
+  EVP_MD_CTX * payload = MD_ctx.back().get();
+
+  // about 1MiB of data at a time, kept for the thread's next split
+  static thread_local std::vector<uint8_t> buff;
+  static thread_local std::vector<std::vector<uint8_t>> shares;
+  buff.resize(std::max((size_t)1 << 20, numData * BLOCKSIZE));
+  for (auto & share : shares)
+  {
+    share.clear();
+  }
+
+  std::string manifest;
+  while(1)
+  {
+    const ssize_t numRead = readFully(fd, buff.data(), buff.size(), -1);
+    attest(numRead >= 0, "Unable to read: %m");
+    encoder.update(buff.data(), numRead, shares);
+    EVP_DigestUpdate(payload, buff.data(), numRead);
+
+    const bool last = (numRead != (ssize_t)buff.size());
+    if (last)
+    {
+      encoder.final(shares);
+    }
     // write data/parity
     for (int idx = 0; idx < (numData + numParity); ++idx)
     {
-      const ssize_t numWritten = write(fds[idx], buff[idx], BLOCKSIZE);
-      attest(numWritten == (ssize_t)BLOCKSIZE,
-             "Unable to write block: '%s'",
-             filename[idx].c_str());
-
-      EVP_DigestUpdate(MD_ctx[idx], buff[idx], BLOCKSIZE);
+      writeFully(fds[idx], shares[idx].data(), shares[idx].size());
+      EVP_DigestUpdate(MD_ctx[idx].get(), shares[idx].data(),
+                       shares[idx].size());
+      shares[idx].clear();
       if (last)
       {
-        // quick nap to try to make the file timestamps pretty.
-        const std::chrono::milliseconds nap(10);
-        close(fds[idx]);
-        PrintMD(md5File, filename[idx], MD_ctx[idx]);
+        EVP_MD_CTX * ctx = MD_ctx[idx].release();
+        manifest += FormatMD(MakeFilename(stub, idx), ctx);
         std::this_thread::sleep_for(nap);
       }
     }
     // done?
     if (last)
     {
-      PrintMD(md5File, stub.c_str(), MD_ctx[256]);
-      fclose(md5File);
-      free(buff);
-      return;
+      EVP_MD_CTX * ctx = MD_ctx.back().release();
+      return manifest + FormatMD(stub, ctx);
+    }
+  }
+}
+void CreateParity(const uint8_t numData,
+                  const uint8_t numParity,
+                  const std::string & stub,
+                  const int fd,
+                  const std::string & suffix,
+                  const bool crc)
+{
+  int fds[250];//numParity + numData];
+  const std::string md5Name = stub + ".sha256";
+  FILE * md5File = fopen((md5Name + suffix).c_str(), "w");
+  attest(md5File, "Unable to open MD file: '%s'", md5Name.c_str());
+
+  for (int idx = 0; idx < (numData + numParity); ++idx)
+  {
+    const std::string filename = MakeFilename(stub, idx);
+    fds[idx] = open((filename + suffix).c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR);
+    attest(fds[idx], "Unable to open file: '%s'", filename.c_str());
+  }
+
+  // quick nap after each share to try to make the file timestamps pretty.
+  const std::string manifest =
+    SplitShares(numData, numParity, stub, fd, fds, crc,
+                std::chrono::milliseconds(10));
+  close(fd);
+  for (int idx = 0; idx < (numData + numParity); ++idx)
+  {
+    close(fds[idx]);
+  }
+  fputs(manifest.c_str(), md5File);
+  fclose(md5File);
+}
+void CreateParity(const uint8_t numData,
+                  const uint8_t numParity,
+                  const std::string & stub,
+                  const bool crc)
+{
+  int fd = open(stub.c_str(), O_RDONLY);
+  attest(fd != -1, "Unable to open \"%s\": %m", stub.c_str());
+  CreateParity(numData, numParity, stub, fd, "", crc);
+}
+
+// the signature follows the tar-blob, whose size is in its header
+static uint32_t SignatureOffset(char * buff)
+{
+  buff[11] = '\0';
+
+  char * endptr = 0;
+  uint32_t s = strtol(buff, &endptr, 8);
+  attest(endptr && (*endptr == '\0'),
+         "unable to decode file size from tar header");
+  return s + 0x200;
+}
+
+uint32_t SignatureOffset(const int fd)
+{
+  char buff[12];
+  ssize_t rc = pread(fd, buff, 11, 124);
+  attest((rc == (ssize_t)11),
+         "unable to read file size from tar header");
+  return SignatureOffset(buff);
+}
+
+/**
+   Read through the header of a share that can't seek (a pipe etc.)
+   to its first block, returning its signature.
+*/
+static bool ProbeStream(const int fd, signature & chk)
+{
+  char header[0x200];
+  if (readFully(fd, header, sizeof(header), -1) != sizeof(header))
+  {
+    return false;
+  }
+  const uint32_t s = SignatureOffset(header + 124);
+  // the signature is padded out to the next BLOCKSIZE boundary
+  const off_t end = (s + sizeof(signature) + BLOCKSIZE - 1) &
+    ~(BLOCKSIZE - 1);
+  return (SkipFully(fd, s - sizeof(header)) &&
+          (readFully(fd, &chk, sizeof(chk), -1) == sizeof(chk)) &&
+          SkipFully(fd, end - (s + sizeof(chk))));
+}
+
+/**
+   Open a share and read its signature, leaving the file at the first
+   block. Doesn't check the signature. Files too short to hold one
+   aren't shares. Pipes and the like are read through to the first
+   block.
+*/
+static int ProbeFile(const std::string & filename,
+                     signature & chk)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return - __LINE__;
+  }
+  struct stat st;
+  if (!fstat(fd, &st) && !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+  {
+    if (ProbeStream(fd, chk))
+    {
+      return fd;
+    }
+    close(fd);
+    return - __LINE__;
+  }
+  // too short to be a share
+  if (fstat(fd, &st) || (S_ISREG(st.st_mode) && (st.st_size < 0x200)))
+  {
+    close(fd);
+    return - __LINE__;
+  }
+
+  const uint32_t s = SignatureOffset(fd);
+  off_t off = lseek(fd, s, SEEK_SET);
+  attest((s == (uint32_t)off),
+         "unable to seek to end of tar-blob");
+
+  ssize_t rc = read(fd, &chk, sizeof(chk));
+  if (rc != sizeof(chk))
+  {
+    close(fd);
+    return - __LINE__;
+  }
+
+  // see to next BLOCKSIZE boundary
+  off += sizeof(signature) + BLOCKSIZE - 1;
+  off &= ~(BLOCKSIZE - 1);
+  attest((lseek(fd, off, SEEK_SET) == off),
+         "unable to seek to end of tar-blob (0x%zx): %m", off);
+
+  return fd;
+}
+
+/**
+   Check a share's signature against the expected one, filling in
+   the unknowns of sig from the first share.
+*/
+static bool CheckSignature(signature & sig, signature chk)
+{
+  // might not know numData yet either...
+  if (sig.numData == 255)
+  {
+    sig.numData   = chk.numData;
+    sig.numParity = chk.numParity;
+    // nor whether the blocks have CRCs
+    sig.blocksizePo2 |= (chk.blocksizePo2 & BLOCK_CRC);
+  }
+  else
+  {
+    // shares added by ExtendShares() have more parity than the
+    // others. The rows don't depend on numParity, so keep the most
+    sig.numParity = std::max(sig.numParity, chk.numParity);
+    chk.numParity = sig.numParity;
+  }
+  // check that
+  return !memcmp(&sig, &chk, sizeof(sig));
+}
+
+struct ShareDecoder::State
+{
+  State(const bool _correct)
+    : correct(_correct)
+    {
+    }
+
+  // check every stripe against all the shares
+  const bool correct;
+  // what the shares have in common, numData == 255 until known
+  signature sig =
+    {
+      .numData      = 255,
+      .numParity    = 255,
+      .fileNum      = 0,
+      .blocksizePo2 = BLOCKSIZE_Po2,
+    };
+  // each slot's bytes not yet used ...
+  std::vector<std::vector<uint8_t>> in = std::vector<std::vector<uint8_t>>(250);
+  // ... from this far into its blocks
+  std::vector<size_t> off = std::vector<size_t>(250, 0);
+  // the share in each slot, -1 until its header's been read
+  std::vector<int> share = std::vector<int>(250, -1);
+  // the slot of each share, -1 if it isn't being given
+  std::vector<int> slot = std::vector<int>(250, -1);
+  // the next stripe to decode
+  size_t stripe = 0;
+  // the last stripe decoded, held back in case it's the final one
+  std::vector<uint8_t> held;
+  // the data blocks being recovered
+  std::vector<uint8_t> scratch;
+  // bad blocks found in each share
+  std::vector<size_t> bad = std::vector<size_t>(250, 0);
+  // slots whose shares have all been given
+  std::vector<bool> ended = std::vector<bool>(250, false);
+  std::unique_ptr<GFM> gfm;
+  RecoveryCache * recovery = nullptr;
+
+  // read the header of the share in slot idx, if there's enough of it
+  void header(const int idx)
+    {
+      std::vector<uint8_t> & buff = in[idx];
+      if (buff.size() < 0x200)
+      {
+        return;
+      }
+      char size[12];
+      memcpy(size, &buff[124], sizeof(size));
+      const uint32_t s = SignatureOffset(size);
+      // the signature is padded out to the next BLOCKSIZE boundary
+      const size_t end = (s + sizeof(signature) + BLOCKSIZE - 1) &
+        ~(BLOCKSIZE - 1);
+      if (buff.size() < end)
+      {
+        return;
+      }
+      signature chk;
+      memcpy(&chk, &buff[s], sizeof(chk));
+      // the header comes from who knows where, check it before using it
+      attest((chk.numData > 0) &&
+             ((chk.numData + chk.numParity) <= 250) &&
+             (chk.fileNum < (chk.numData + chk.numParity)),
+             "slot %d: not a valid share (%u data, %u parity, share %02x)",
+             idx, (unsigned)chk.numData, (unsigned)chk.numParity,
+             (unsigned)chk.fileNum);
+      sig.fileNum = chk.fileNum;
+      attest(CheckSignature(sig, chk),
+             "share %02x doesn't match the others", (unsigned)chk.fileNum);
+      attest(slot[chk.fileNum] < 0,
+             "share %02x given twice", (unsigned)chk.fileNum);
+      buff.erase(buff.begin(), buff.begin() + end);
+      share[idx] = chk.fileNum;
+      slot[chk.fileNum] = idx;
+      // shares added later may have more parity
+      if (!gfm || (gfm->rows() < (sig.numData + sig.numParity)))
+      {
+        gfm.reset(new GFM(sig.numData, sig.numParity));
+        recovery = &SharedRecovery(sig.numData, sig.numParity);
+      }
+    }
+
+  // decode the next stripe from the first numData shares with a good
+  // block of it, returning false if there aren't enough yet. When
+  // correcting, every share must have its block first, unless they've
+  // all been given.
+  bool decode(std::vector<uint8_t> & data, const bool all = false)
+    {
+      if (!gfm)
+      {
+        return false;
+      }
+      const uint8_t numData = sig.numData;
+      const int numShares = numData + sig.numParity;
+      const bool crc = sig.blocksizePo2 & BLOCK_CRC;
+      const size_t recordSize = RecordSize(crc);
+      const size_t pos = stripe * recordSize;
+      std::vector<uint8_t *> blocks(numShares, nullptr);
+      std::vector<bool> crcBad(numShares, false);
+      int numGood = 0;
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        if ((slot[idx] < 0) || (!correct && (numGood == numData)))
+        {
+          continue;
+        }
+        const int s = slot[idx];
+        if ((off[s] + in[s].size()) < (pos + recordSize))
+        {
+          if (correct && !all)
+          {
+            return false;
+          }
+          continue;
+        }
+        uint8_t * block = &in[s][pos - off[s]];
+        uint32_t check;
+        if (crc &&
+            (memcpy(&check, block + BLOCKSIZE, CRC_SIZE),
+             crc32c(block, BLOCKSIZE) != le32toh(check)))
+        {
+          crcBad[idx] = true;
+          continue;
+        }
+        blocks[idx] = block;
+        ++numGood;
+      }
+      if (numGood < numData)
+      {
+        return false;
+      }
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        bad[idx] += crcBad[idx];
+      }
+      // the spare blocks locate any corrupt ones
+      std::vector<bool> corrupt;
+      if (correct)
+      {
+        attest(gfm->locate(blocks.data(), BLOCKSIZE, corrupt),
+               "stripe %zu: too many corrupt shares to correct", stripe);
+        for (int idx = 0; idx < numShares; ++idx)
+        {
+          bad[idx] += corrupt[idx];
+        }
+      }
+      std::vector<uint8_t *> rows(numShares, nullptr);
+      std::vector<bool> used(numShares, false);
+      for (int idx = 0, numUsed = 0;
+           (idx < numShares) && (numUsed < numData); ++idx)
+      {
+        if (blocks[idx] && !(correct && corrupt[idx]))
+        {
+          rows[idx] = blocks[idx];
+          used[idx] = true;
+          ++numUsed;
+        }
+      }
+      scratch.resize(numData * BLOCKSIZE);
+      for (int idx = 0; idx < numData; ++idx)
+      {
+        if (!used[idx])
+        {
+          rows[idx] = &scratch[idx * BLOCKSIZE];
+        }
+      }
+      gfm->recover(rows.data(), (*recovery)(used), BLOCKSIZE);
+
+      // the one before is not the last, so all of it is data
+      if (!held.empty())
+      {
+        data.insert(data.end(), held.begin(), held.end() - 1);
+      }
+      held.resize(numData * BLOCKSIZE);
+      for (int idx = 0; idx < numData; ++idx)
+      {
+        memcpy(&held[idx * BLOCKSIZE], rows[idx], BLOCKSIZE);
+      }
+      ++stripe;
+      return true;
+    }
+
+  // would more of slot idx help decode the next stripe? Shares whose
+  // headers haven't been read are needed, as are all of them when
+  // correcting. Otherwise just enough of the lowest numbered shares
+  // that could have a good block, more if there are bad blocks.
+  bool wants(const int idx) const
+    {
+      if (ended[idx])
+      {
+        return false;
+      }
+      if ((share[idx] < 0) || correct)
+      {
+        return true;
+      }
+      const int numData = sig.numData;
+      const size_t recordSize = RecordSize(sig.blocksizePo2 & BLOCK_CRC);
+      const size_t pos = stripe * recordSize;
+      // numData shares ending together mark the end of them all
+      size_t last = 0;
+      int numLast = 0;
+      for (size_t sl = 0; sl < in.size(); ++sl)
+      {
+        if (ended[sl] && (share[sl] >= 0))
+        {
+          const size_t len = off[sl] + in[sl].size();
+          numLast = (len > last) ? 0 : numLast;
+          last    = std::max(last, len);
+          numLast += (len == last);
+        }
+      }
+      if ((numLast >= numData) && (pos >= last))
+      {
+        return false;
+      }
+      // those with the block have been tried, if there are enough of
+      // them some are bad and one more is needed
+      int numHave = 0;
+      for (int num = 0; num < (sig.numData + sig.numParity); ++num)
+      {
+        const int sl = slot[num];
+        numHave += ((sl >= 0) && ((off[sl] + in[sl].size()) >=
+                                  (pos + recordSize)));
+      }
+      int numWanted = std::max(1, numData - numHave);
+      for (int num = 0; num < (sig.numData + sig.numParity); ++num)
+      {
+        const int sl = slot[num];
+        if ((sl < 0) || ended[sl] ||
+            ((off[sl] + in[sl].size()) >= (pos + recordSize)))
+        {
+          continue;
+        }
+        if (sl == idx)
+        {
+          return true;
+        }
+        if (!--numWanted)
+        {
+          return false;
+        }
+      }
+      return false;
+    }
+
+  // drop what's been decoded, once it's at least half of what's held,
+  // so each byte is moved at most once on average
+  void trim()
+    {
+      if (!gfm)
+      {
+        return;
+      }
+      const size_t pos = stripe * RecordSize(sig.blocksizePo2 & BLOCK_CRC);
+      for (size_t idx = 0; idx < in.size(); ++idx)
+      {
+        if ((share[idx] < 0) || (off[idx] >= pos))
+        {
+          continue;
+        }
+        const size_t num = std::min(in[idx].size(), pos - off[idx]);
+        if ((num * 2) < in[idx].size())
+        {
+          continue;
+        }
+        in[idx].erase(in[idx].begin(), in[idx].begin() + num);
+        off[idx] += num;
+      }
+    }
+};
+
+ShareDecoder::ShareDecoder(const bool _correct)
+  : correct(_correct)
+  , state(new State(_correct))
+{
+}
+
+ShareDecoder::~ShareDecoder()
+{
+}
+
+void ShareDecoder::update(const uint8_t slot,
+                          const void * buff,
+                          size_t len,
+                          std::vector<uint8_t> & data)
+{
+  State & s = *state;
+  attest(slot < s.in.size(), "no slot %u", (unsigned)slot);
+  const uint8_t * p = (const uint8_t *)buff;
+  s.in[slot].insert(s.in[slot].end(), p, p + len);
+  if (s.share[slot] < 0)
+  {
+    s.header(slot);
+  }
+  while (s.decode(data))
+  {
+  }
+  s.trim();
+}
+
+bool ShareDecoder::wants(const uint8_t slot) const
+{
+  return (slot < state->in.size()) && state->wants(slot);
+}
+
+void ShareDecoder::end(const uint8_t slot)
+{
+  attest(slot < state->in.size(), "no slot %u", (unsigned)slot);
+  state->ended[slot] = true;
+}
+
+void ShareDecoder::final(std::vector<uint8_t> & data)
+{
+  State & s = *state;
+  attest(s.gfm.get(), "no shares");
+  while (s.decode(data, true))
+  {
+  }
+  // any blocks left are of stripes that can't be recovered
+  const size_t pos = s.stripe * RecordSize(s.sig.blocksizePo2 & BLOCK_CRC);
+  for (size_t idx = 0; idx < s.in.size(); ++idx)
+  {
+    attest((s.share[idx] < 0) || ((s.off[idx] + s.in[idx].size()) <= pos),
+           "stripe %zu: not enough good blocks", s.stripe);
+  }
+  attest(!s.held.empty(), "no data in shares");
+  // drop the final stripe's padding
+  data.insert(data.end(), s.held.begin(),
+              s.held.begin() + removePadding(s.held.data(), s.held.size()));
+  bad = s.bad;
+  state.reset(new State(correct));
+}
+std::vector<size_t> DecodeShares(const std::vector<int> & fds,
+                                 const int fd,
+                                 const bool correct,
+                                 EVP_MD_CTX * ctx)
+{
+  attest(!fds.empty(), "no shares");
+  attest(fds.size() <= 250, "too many shares: %zu", fds.size());
+  ShareDecoder decoder(correct);
+  // a share's worth of stripes at a time, kept for the thread's next job
+  static thread_local std::vector<uint8_t> buff;
+  static thread_local std::vector<uint8_t> data;
+  buff.resize((size_t)1 << 16);
+  data.clear();
+
+  // read only what the decoder wants, the other shares are spares
+  std::vector<bool> done(fds.size(), false);
+  bool reading = true;
+  while (reading)
+  {
+    reading = false;
+    for (size_t idx = 0; idx < fds.size(); ++idx)
+    {
+      if (done[idx] || !decoder.wants(idx))
+      {
+        continue;
+      }
+      reading = true;
+      const ssize_t numRead = readFully(fds[idx], buff.data(), buff.size(), -1);
+      attest(numRead >= 0, "Unable to read share: %m");
+      decoder.update(idx, buff.data(), numRead, data);
+      if (numRead != (ssize_t)buff.size())
+      {
+        done[idx] = true;
+        decoder.end(idx);
+      }
+      if (fd >= 0)
+      {
+        writeFully(fd, data.data(), data.size());
+      }
+      if (ctx)
+      {
+        EVP_DigestUpdate(ctx, data.data(), data.size());
+      }
+      data.clear();
+    }
+  }
+  decoder.final(data);
+  if (fd >= 0)
+  {
+    writeFully(fd, data.data(), data.size());
+  }
+  if (ctx)
+  {
+    EVP_DigestUpdate(ctx, data.data(), data.size());
+  }
+  data.clear();
+  return decoder.corrupt();
+}
+
+int OpenFile(const std::string & filename,
+             signature & sig)
+{
+  signature chk;
+  int fd = ProbeFile(filename, chk);
+  if (fd < 0)
+  {
+    return fd;
+  }
+  if (!CheckSignature(sig, chk))
+  {
+    close(fd);
+    return - __LINE__;
+  }
+  return fd;
+}
+
+int OpenFile(const std::string & filename,
+             const uint8_t idx,
+             GFM & gfm,
+             signature & sig)
+{
+  int fd = OpenFile(filename, sig);
+  if (fd >= 0)
+  {
+    return fd;
+  }
+  gfm.failData(idx);
+  return - __LINE__;;
+}
+
+void pwriteFully(const int fd, const void * buff, size_t len, off_t off)
+{
+  const uint8_t * p = (const uint8_t *)buff;
+  while (len)
+  {
+    const ssize_t rc = pwrite(fd, p, len, off);
+    attest(rc > 0, "Expected to write %zu, wrote %zd: %m", len, rc);
+    p   += rc;
+    len -= rc;
+    off += rc;
+  }
+}
+
+// write all of iov, at off (if not negative), IOV_MAX pieces at a time
+static void writevFully(const int fd, std::vector<struct iovec> & iov,
+                        off_t off)
+{
+  size_t first = 0;
+  while (first < iov.size())
+  {
+    const int cnt = std::min(iov.size() - first, (size_t)IOV_MAX);
+    const ssize_t rc = (off < 0) ? writev(fd, &iov[first], cnt) :
+      pwritev(fd, &iov[first], cnt, off);
+    attest(rc > 0, "Expected to write %zu pieces, wrote %zd: %m",
+           iov.size() - first, rc);
+    off += (off < 0) ? 0 : rc;
+    // skip what was written, including part of a piece
+    for (size_t left = rc; left; )
+    {
+      const size_t n = std::min(left, iov[first].iov_len);
+      iov[first].iov_base = (uint8_t *)iov[first].iov_base + n;
+      iov[first].iov_len -= n;
+      left               -= n;
+      first              += !iov[first].iov_len;
+    }
+  }
+}
+
+/**
+   Reads blocks of a share on a thread of its own, so the reads of all
+   the shares overlap each other and the decoding of the previous
+   batch. The readers of a recovery share a mutex and condition
+   variable so it can wait for whichever finish first. Blocks are read
+   at their offset from where the share was when the reader started,
+   so a reader that falls behind can skip a batch. Shares that can't
+   seek (pipes) are read through to the stripe wanted instead. A read
+   is done in chunks so it can be cancelled once it's no longer
+   needed, what's been read is then counted as if it were short.
+
+   With hash, a share read from its first block to its end without
+   skipping any is checksummed on the way, header and all.
+*/
+class ShareReader
+{
+public:
+  ShareReader(const int _fd,
+              const bool _crc,
+              std::mutex & _mutex,
+              std::condition_variable & _cv,
+              const bool hash = false)
+    : fd(_fd)
+    , crc(_crc)
+    , origin(lseek(_fd, 0, SEEK_CUR))
+    , mutex(_mutex)
+    , cv(_cv)
+    , ctx(hash ? EVP_MD_CTX_create() : nullptr)
+    , thread(&ShareReader::run, this)
+    {
+      if (ctx)
+      {
+        EVP_DigestInit_ex(ctx, EVP_sha256(), 0);
+      }
+    }
+
+  virtual ~ShareReader()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      cv.notify_all();
+      thread.join();
+      if (ctx)
+      {
+        EVP_MD_CTX_destroy(ctx);
+      }
+    }
+
+  /// the share's checksum as a "sha256sum"-style line if it was read
+  /// whole, otherwise empty. With the reader idle
+  std::string sum(const std::string & filename)
+    {
+      if (!ctx || !whole || !eof)
+      {
+        return std::string();
+      }
+      return FormatMD(filename, ctx);
+    }
+
+  /// start reading up to numBlocks blocks from the stripe into row,
+  /// with the mutex held
+  void start(uint8_t * _row,
+             const size_t _stripe,
+             const size_t _numBlocks,
+             uint8_t * _bad)
+    {
+      row       = _row;
+      stripe    = _stripe;
+      numBlocks = _numBlocks;
+      bad       = _bad;
+      pending   = true;
+      cancelled = false;
+      cv.notify_all();
+    }
+
+  /// stop reading after the current chunk, with the mutex held
+  void cancel()
+    {
+      cancelled = true;
+    }
+
+  /// still reading? With the mutex held
+  bool busy() const
+    {
+      return pending;
+    }
+
+  /// the number of blocks read, with the mutex held
+  size_t count() const
+    {
+      return numRead;
+    }
+
+  /// did the read fail? With the mutex held. Rethrows anything the
+  /// reader threw
+  bool failed() const
+    {
+      if (thrown)
+      {
+        std::rethrow_exception(thrown);
+      }
+      return error;
+    }
+
+private:
+  void run()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+      {
+        cv.wait(lock, [this]() { return pending || stop; });
+        if (!pending)
+        {
+          return;
+        }
+        lock.unlock();
+        const off_t off = (origin < 0) ? -1 :
+          (origin + (off_t)(stripe * RecordSize(crc)));
+        // catch up on a pipe
+        bool fail = ((origin < 0) && (stripe < expect));
+        size_t rc = 0;
+        // cancelled before reading all the blocks?
+        bool cut = false;
+        try
+        {
+          if ((origin < 0) && (stripe > expect))
+          {
+            fail = !SkipFully(fd, (stripe - expect) * RecordSize(crc));
+          }
+          // checksum the header before the first block
+          whole &= (ctx && (stripe == expect) && (origin >= 0));
+          if (whole && !stripe)
+          {
+            std::vector<uint8_t> header(origin);
+            whole = (pread(fd, header.data(), origin, 0) == origin);
+            EVP_DigestUpdate(ctx, header.data(), header.size());
+          }
+          while ((rc < numBlocks) && !fail)
+          {
+            if (cancelled)
+            {
+              cut = true;
+              break;
+            }
+            const size_t want = std::min(numBlocks - rc, CHUNK);
+            const off_t at = (off < 0) ? -1 :
+              (off + (off_t)(rc * RecordSize(crc)));
+            const size_t got =
+              ReadBlocks(fd, row + (rc * BLOCKSIZE), want, crc, bad + rc, at,
+                         &fail, whole ? ctx : nullptr);
+            rc += got;
+            if (got < want)
+            {
+              break;
+            }
+          }
+        }
+        catch (...)
+        {
+          // for failed() to rethrow
+          thrown = std::current_exception();
+          fail   = true;
+        }
+        whole  &= !fail;
+        expect  = stripe + rc;
+        eof     = (rc < numBlocks) && !cut;
+        lock.lock();
+        numRead = rc;
+        error   = fail;
+        pending = false;
+        cv.notify_all();
+      }
+    }
+
+  // blocks read at a time
+  static const size_t CHUNK = 256;
+
+  const int   fd;
+  const bool  crc;
+  const off_t origin;
+  std::mutex & mutex;
+  std::condition_variable & cv;
+  // checksum, the stripe it's up to and whether it's all there
+  EVP_MD_CTX * ctx;
+  size_t    expect    = 0;
+  bool      whole     = true;
+  bool      eof       = false;
+  uint8_t * row       = nullptr;
+  size_t    stripe    = 0;
+  size_t    numBlocks = 0;
+  uint8_t * bad       = nullptr;
+  size_t    numRead   = 0;
+  bool      error     = false;
+  std::exception_ptr thrown;
+  bool      pending   = false;
+  bool      stop      = false;
+  std::atomic<bool> cancelled { false };
+  // last, it uses the rest
+  std::thread thread;
+};
+
+/**
+   How a recovery reads the shares: the stripes holding the bytes
+   [lo, hi) of the data, batch stripes at a time. A batch is
+   options.batch bytes of each share, or about 2MiB of data per
+   thread. Stripes are independent, so the shares are read from the
+   first stripe holding lo and no further than the stripe after the
+   one holding the last byte.
+*/
+struct BatchPlan
+{
+  BatchPlan(const uint8_t numData,
+            const bool crc,
+            const RecoveryOptions & options)
+    : stripeSize(numData * BLOCKSIZE)
+    , outSize(stripeSize - 1)
+    , recordSize(RecordSize(crc))
+    , numThreads(std::max(1u, std::thread::hardware_concurrency()))
+    , batch(std::max((size_t)2, options.batch ?
+                     (options.batch / BLOCKSIZE) :
+                     (((size_t)numThreads << 21) / stripeSize)))
+    , lo(options.offset)
+    , hi((options.length < 0) ? std::numeric_limits<off_t>::max() :
+         (lo + options.length))
+    , firstStripe(lo / outSize)
+    , origin(firstStripe * outSize)
+    , needed((options.length < 0) ? SIZE_MAX :
+             (std::max(hi - origin, (off_t)1) + outSize - 1) / outSize)
+    {
+      attest(lo >= 0, "invalid offset %jd", (intmax_t)lo);
+    }
+
+  /// stripes to read for the first batch, plus one to tell if the
+  /// last is the final (padded) one
+  size_t first() const
+    {
+      return (needed < batch) ? (needed + 1) : batch;
+    }
+
+  /// stripes to read for the next batch, once recovered stripes have
+  /// been, the stripe carried over taking up the first row
+  size_t next(const size_t recovered) const
+    {
+      const size_t left = needed - recovered;
+      return ((left < batch) ? (left + 1) : batch) - 1;
+    }
+
+  /// would more stripes be needed after recovered?
+  bool more(const size_t recovered) const
+    {
+      return recovered < needed;
+    }
+
+  // bytes of a stripe as decoded, and as recovered (less the padding
+  // flag), and of a block in the shares
+  const size_t stripeSize;
+  const size_t outSize;
+  const size_t recordSize;
+  const unsigned numThreads;
+  // stripes per batch
+  const size_t batch;
+  // the bytes wanted
+  const off_t lo;
+  const off_t hi;
+  // the stripe holding lo, and where its data starts
+  const size_t firstStripe;
+  const off_t  origin;
+  // stripes needed from firstStripe on, up to the last byte wanted
+  const size_t needed;
+};
+
+/**
+   The readers of the shares of a recovery, and the two sets of rows
+   they read into: the next batch is read into one while the other is
+   decoded.
+
+   More than numData shares may be open (options.hedge), each batch is
+   then taken from the first numData to be read. The data shares being
+   read get separate rows to recover into, as a share that's late
+   might still be reading into its own. Once a batch has been taken,
+   readers still reading it are cancelled, and sit the next batch out
+   if they're still busy.
+
+   A share that fails to read, or reads less than the others, is
+   dropped from then on and replaced by one of the spares (if need
+   be), which reads the batch again.
+
+   Only the stripes of the plan are read, the shares seeked straight
+   to the first of them. With hash, shares read whole are checksummed
+   (see sum()).
+*/
+class ReaderPool
+{
+public:
+  ReaderPool(const uint8_t _numData,
+             const uint8_t numParity,
+             const int * fds,
+             const int * spares,
+             const bool _crc,
+             const BatchPlan & _plan,
+             const bool _correct,
+             const bool hash)
+    : numData(_numData)
+    , numShares(_numData + numParity)
+    , crc(_crc)
+    , plan(_plan)
+    , correct(_correct)
+    , readers(numShares)
+    , dead(numShares, false)
+    , spare(numShares, -1)
+    {
+      const int numOpen = std::count_if(fds, fds + numShares,
+                                        [](const int f) { return f >= 0; });
+      attest(numOpen >= numData, "not enough recovery data");
+      hedged = (numOpen > numData);
+      for (int idx = 0; (idx < numShares) && spares; ++idx)
+      {
+        spare[idx] = std::max(spares[idx], -1);
+      }
+
+      auto open = [&](const int idx)
+        {
+          return (fds[idx] >= 0) || (spare[idx] >= 0);
+        };
+      const size_t batch = plan.batch;
+      int numRows = 0;
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        numRows += ((idx < numData) || open(idx)) +
+          ((idx < numData) && open(idx) && hedged);
+      }
+      in.resize(2 * numRows * batch * BLOCKSIZE);
+      for (int set = 0, row = 0; set < 2; ++set)
+      {
+        rowSets[set].assign(numShares, nullptr);
+        recvSets[set].assign(numData, nullptr);
+        badSets[set].assign(numShares, std::vector<uint8_t>(batch));
+        for (int idx = 0; idx < numShares; ++idx)
+        {
+          if ((idx < numData) || open(idx))
+          {
+            rowSets[set][idx] = &in[(row++) * batch * BLOCKSIZE];
+          }
+          if (idx < numData)
+          {
+            recvSets[set][idx] = (open(idx) && hedged) ?
+              &in[(row++) * batch * BLOCKSIZE] : rowSets[set][idx];
+          }
+        }
+      }
+
+      // skip to the stripe holding the first byte wanted
+      const size_t firstStripe = plan.firstStripe;
+      for (int idx = 0; (idx < numShares) && firstStripe; ++idx)
+      {
+        if (open(idx))
+        {
+          const int share = (fds[idx] >= 0) ? fds[idx] : spare[idx];
+          attest(SkipFully(share, firstStripe * plan.recordSize),
+                 "unable to skip to stripe %zu of share %02x: %m",
+                 firstStripe, idx);
+        }
+      }
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        if (fds[idx] >= 0)
+        {
+          readers[idx].reset(new ShareReader(fds[idx], crc, mutex, cv,
+                                             hash && !firstStripe));
+        }
+      }
+    }
+
+  /// waits for the readers to stop
+  ~ReaderPool()
+    {
+      finish();
+    }
+
+  /// are there more shares open than needed?
+  bool isHedged() const
+    {
+      return hedged;
+    }
+
+  /**
+     Start reading count stripes from stripe "from" into the rows of
+     set from stripe "at".
+  */
+  void post(const int set,
+            const size_t at,
+            const size_t from,
+            const size_t count)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      posted[set].assign(numShares, false);
+      batches[set] = { at, from, count };
+      fill(set, lock);
+    }
+
+  /**
+     Wait for the first numData shares reading into set (all of them
+     if correcting), marking them used and those read as got, and
+     returning the number of stripes read. The rest are cancelled.
+  */
+  size_t collect(const int set,
+                 std::vector<bool> & used,
+                 std::vector<bool> & got)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto arrived = [&](const int idx)
+        {
+          return posted[set][idx] && !readers[idx]->busy();
+        };
+      // the stripes read
+      size_t longest = 0;
+      while (true)
+      {
+        cv.wait(lock, [&]()
+                {
+                  int numArrived = 0;
+                  int numPosted  = 0;
+                  for (int idx = 0; idx < numShares; ++idx)
+                  {
+                    numArrived += arrived(idx);
+                    numPosted  += posted[set][idx];
+                  }
+                  return (numArrived >= numData) &&
+                    (!correct || (numArrived == numPosted));
+                });
+        if (!dropFailed(set, longest))
+        {
+          break;
+        }
+        fill(set, lock);
+      }
+      used.assign(numShares, false);
+      got.assign(numShares, false);
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        got[idx] = arrived(idx);
+        if (posted[set][idx] && !got[idx])
+        {
+          readers[idx]->cancel();
+        }
+      }
+      for (int idx = 0, numUsed = 0;
+           (idx < numShares) && (numUsed < numData); ++idx)
+      {
+        if (arrived(idx))
+        {
+          used[idx] = true;
+          ++numUsed;
+        }
+      }
+      return longest;
+    }
+
+  /// the rows of set to decode from and into, given the shares used
+  std::vector<uint8_t *> rows(const int set,
+                              const std::vector<bool> & used) const
+    {
+      std::vector<uint8_t *> ret(numShares, nullptr);
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        ret[idx] = used[idx] ? rowSets[set][idx] :
+          (idx < numData) ? recvSets[set][idx] : nullptr;
+      }
+      return ret;
+    }
+
+  /// the rows the shares read set into
+  const std::vector<uint8_t *> & read(const int set) const
+    {
+      return rowSets[set];
+    }
+
+  /// the bad blocks flagged in the rows of set
+  const std::vector<std::vector<uint8_t>> & bad(const int set) const
+    {
+      return badSets[set];
+    }
+
+  /// cancel any late readers and wait for them
+  void finish()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (const auto & reader : readers)
+      {
+        if (reader && reader->busy())
+        {
+          reader->cancel();
+        }
+      }
+      cv.wait(lock, [&]()
+              {
+                return std::none_of(readers.begin(), readers.end(),
+                                    [](const std::unique_ptr<ShareReader> & r)
+                                    { return r && r->busy(); });
+              });
+    }
+
+  /// share idx's checksum line, if it was read whole (once finished)
+  std::string sum(const int idx, const std::string & filename) const
+    {
+      return readers[idx] ? readers[idx]->sum(filename) : std::string();
+    }
+
+private:
+  // make sure at least numData shares are reading into set, waiting
+  // for some to finish earlier batches or bringing in spares if need be
+  // (with the mutex held)
+  void fill(const int set, std::unique_lock<std::mutex> & lock)
+    {
+      while (true)
+      {
+        int numPosted = 0;
+        int numLive   = 0;
+        for (int idx = 0; idx < numShares; ++idx)
+        {
+          if (!readers[idx] || dead[idx])
+          {
+            continue;
+          }
+          ++numLive;
+          if (!posted[set][idx] && !readers[idx]->busy())
+          {
+            const size_t at = batches[set].at;
+            readers[idx]->start(rowSets[set][idx] + (at * BLOCKSIZE),
+                                batches[set].from, batches[set].count,
+                                &badSets[set][idx][at]);
+            posted[set][idx] = true;
+          }
+          numPosted += posted[set][idx];
+        }
+        if (numPosted >= (correct ? numLive : numData))
+        {
+          return;
+        }
+        if (numLive < numData)
+        {
+          failover();
+          continue;
+        }
+        // too many are still reading earlier batches
+        cv.wait(lock);
+      }
+    }
+
+  /**
+     Drop the shares that arrived in set having failed or read less
+     than the others, returning whether any were, and setting longest
+     to the stripes read by the rest (with the mutex held).
+  */
+  bool dropFailed(const int set, size_t & longest)
+    {
+      auto arrived = [&](const int idx)
+        {
+          return posted[set][idx] && !readers[idx]->busy();
+        };
+      longest = 0;
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        if (arrived(idx) && !readers[idx]->failed())
+        {
+          longest = std::max(longest, readers[idx]->count());
+        }
+      }
+      bool dropped = false;
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        if (arrived(idx) &&
+            (readers[idx]->failed() || (readers[idx]->count() < longest)))
+        {
+          const size_t stripe =
+            plan.firstStripe + batches[set].from + readers[idx]->count();
+          std::cerr << "share " << std::setw(2) << std::setfill('0')
+                    << std::hex << idx << std::dec
+                    << " failed at stripe " << stripe
+                    << ", byte " << (stripe * plan.outSize)
+                    << " of the data" << std::endl;
+          dead[idx] = true;
+          posted[set][idx] = false;
+          dropped = true;
+        }
+      }
+      return dropped;
+    }
+
+  // start reading the next spare, for a share that's been dropped
+  // (with the mutex held)
+  void failover()
+    {
+      const auto it = std::find_if(spare.begin(), spare.end(),
+                                   [](const int f) { return f >= 0; });
+      attest(it != spare.end(), "not enough shares left");
+      const int idx = it - spare.begin();
+      std::cerr << "switching to share " << std::setw(2)
+                << std::setfill('0') << std::hex << idx << std::dec
+                << std::endl;
+      readers[idx].reset(new ShareReader(*it, crc, mutex, cv));
+      *it = -1;
+    }
+
+  const uint8_t numData;
+  const int     numShares;
+  const bool    crc;
+  const BatchPlan & plan;
+  const bool    correct;
+  bool          hedged;
+  std::vector<uint8_t> in;
+  std::vector<uint8_t *> rowSets[2];
+  std::vector<uint8_t *> recvSets[2];
+  std::vector<std::vector<uint8_t>> badSets[2];
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::unique_ptr<ShareReader>> readers;
+  // shares that have failed, and the spares to replace them
+  std::vector<bool> dead;
+  std::vector<int>  spare;
+  // the shares reading into each set, and what they're reading
+  std::vector<bool> posted[2];
+  struct
+  {
+    size_t at;
+    size_t from;
+    size_t count;
+  } batches[2];
+};
+
+/**
+   Checks a recovery against the stub's .sha256 manifest, if it has
+   one: the shares the ReaderPool read whole (hashShares()), and the
+   data if it's all being recovered, its checksum taken as it's
+   written (data()). A share that doesn't match is reported, data that
+   doesn't is fatal.
+*/
+class ManifestCheck
+{
+public:
+  ManifestCheck(const std::string & _stub,
+                const BatchPlan & plan,
+                const RecoveryOptions & options)
+    : stub(_stub)
+    {
+      if (!stub.empty())
+      {
+        manifest = ReadManifest(stub);
+      }
+      if (!manifest.empty() && !plan.lo && (options.length < 0))
+      {
+        sum = EVP_MD_CTX_create();
+        EVP_DigestInit_ex(sum, EVP_sha256(), 0);
+      }
+    }
+
+  ~ManifestCheck()
+    {
+      if (sum)
+      {
+        EVP_MD_CTX_destroy(sum);
+      }
+    }
+
+  /// should the shares be checksummed as they're read?
+  bool hashShares() const
+    {
+      return !manifest.empty();
+    }
+
+  /// the checksum of the data, if it's to be checked
+  EVP_MD_CTX * data() const
+    {
+      return sum;
+    }
+
+  /// check the numShares shares read by the (finished) pool, and the data
+  void check(const ReaderPool & pool, const int numShares)
+    {
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        const std::string line = pool.sum(idx, MakeFilename(stub, idx));
+        if (!line.empty() && !CheckMD(manifest, line))
+        {
+          std::cerr << "share " << std::setw(2) << std::setfill('0')
+                    << std::hex << idx << std::dec << " doesn't match "
+                    << stub << ".sha256" << std::endl;
+        }
+      }
+      if (sum)
+      {
+        const std::string line = FormatMD(stub, sum);
+        attest(CheckMD(manifest, line),
+               "recovered data doesn't match %s.sha256", stub.c_str());
+        if (FindMD(manifest, line) != manifest.end())
+        {
+          std::cerr << "recovered data matches " << stub << ".sha256"
+                    << std::endl;
+        }
+      }
+    }
+
+private:
+  const std::string stub;
+  std::vector<std::string> manifest;
+  EVP_MD_CTX * sum = nullptr;
+};
+
+/**
+   Fixes the blocks of a batch before it's decoded: blocks that failed
+   their CRC32C are re-calculated from the other shares, falling back
+   on the spares. With correct, the corrupt blocks are then located
+   from all the shares read (gfm.locate(), spread over the threads)
+   and fixed as if they were bad, a stripe with too many being fatal.
+*/
+class BatchCorrector
+{
+public:
+  BatchCorrector(GFM & _gfm,
+                 const uint8_t numData,
+                 const uint8_t numParity,
+                 const int * fds,
+                 const int * spares,
+                 const BatchPlan & _plan,
+                 const bool _correct,
+                 const bool hedged)
+    : gfm(_gfm)
+    , numShares(numData + numParity)
+    , plan(_plan)
+    , correct(_correct)
+    , fixer(numData, numParity, spares, fds)
+    {
+      if (correct && !hedged)
+      {
+        std::cerr << "no spare shares to correct with" << std::endl;
+      }
+    }
+
+  /**
+     Fix stripes [have, have + numRead) of the rows, stripe "at" of
+     the shares being their first. read are the rows the shares read
+     into, bad their bad blocks, and used and got as from
+     ReaderPool::collect().
+  */
+  void fix(const size_t at,
+           const std::vector<uint8_t *> & rows,
+           const std::vector<uint8_t *> & read,
+           const std::vector<std::vector<uint8_t>> & bad,
+           const std::vector<bool> & used,
+           const std::vector<bool> & got,
+           const size_t have,
+           const size_t numRead)
+    {
+      for (size_t stripe = have; stripe < (have + numRead); ++stripe)
+      {
+        std::vector<uint8_t *> blocks(numShares, nullptr);
+        std::vector<bool> bads(numShares, false);
+        bool any = false;
+        for (int idx = 0; idx < numShares; ++idx)
+        {
+          if (used[idx])
+          {
+            blocks[idx] = rows[idx] + (stripe * BLOCKSIZE);
+            bads[idx] = bad[idx][stripe];
+            any |= bads[idx];
+          }
+        }
+        if (any)
+        {
+          fixer.fix(at + stripe, blocks, bads);
+        }
+      }
+      if (correct)
+      {
+        locate(at, read, bad, used, got, have, numRead);
+      }
+    }
+
+private:
+  // locate the corrupt blocks from all the shares read, then fix
+  // them as if they were bad
+  void locate(const size_t at,
+              const std::vector<uint8_t *> & read,
+              const std::vector<std::vector<uint8_t>> & bad,
+              const std::vector<bool> & used,
+              const std::vector<bool> & got,
+              const size_t have,
+              const size_t numRead)
+    {
+      std::vector<std::vector<uint8_t *>> blocks(numRead);
+      std::vector<std::vector<bool>> corrupt(numRead);
+      std::vector<uint8_t> located(numRead);
+      auto check = [&](const size_t first, const size_t end)
+        {
+          for (size_t pos = first; pos < end; ++pos)
+          {
+            const size_t stripe = have + pos;
+            blocks[pos].assign(numShares, nullptr);
+            for (int idx = 0; idx < numShares; ++idx)
+            {
+              if (got[idx] && (used[idx] || !bad[idx][stripe]))
+              {
+                blocks[pos][idx] = read[idx] + (stripe * BLOCKSIZE);
+              }
+            }
+            located[pos] =
+              gfm.locate(blocks[pos].data(), BLOCKSIZE, corrupt[pos]);
+          }
+        };
+      const unsigned numThreads = plan.numThreads;
+      const size_t slice = (numRead + numThreads - 1) / numThreads;
+      std::vector<Thread> workers;
+      for (size_t first = 0; (first < numRead) && (numThreads > 1);
+           first += slice)
+      {
+        const size_t to = std::min(numRead, first + slice);
+        workers.emplace_back([&, first, to]() { check(first, to); });
+      }
+      if (numThreads == 1)
+      {
+        check(0, numRead);
+      }
+      JoinAll(workers);
+      for (size_t pos = 0; pos < numRead; ++pos)
+      {
+        const size_t stripe = at + have + pos;
+        attest(located[pos], "stripe %zu: too many corrupt shares to correct",
+               stripe);
+        if (std::none_of(corrupt[pos].begin(), corrupt[pos].end(),
+                         [](const bool b) { return b; }))
+        {
+          continue;
+        }
+        for (int idx = 0; idx < numShares; ++idx)
+        {
+          if (corrupt[pos][idx])
+          {
+            std::cerr << "stripe " << stripe << ", share " << std::setw(2)
+                      << std::setfill('0') << std::hex << idx << std::dec
+                      << " is corrupt, corrected" << std::endl;
+          }
+        }
+        fixer.fix(stripe, blocks[pos], corrupt[pos]);
+      }
+    }
+
+  GFM & gfm;
+  const int numShares;
+  const BatchPlan & plan;
+  const bool correct;
+  BlockFixer fixer;
+};
+
+/**
+   Writes the recovered bytes [plan.lo, plan.hi) of the data. A regular
+   output file is written in place with pwrite() at each stripe's
+   offset, so threads can write their stripes in any order. It is
+   preallocated to what share (positioned at the plan's first stripe)
+   implies of the range, and cut to what's recovered by finish().
+   Anything else (a pipe, an O_APPEND file) is written in order.
+
+   The data, in order, goes through hash() (gather() does its own) to
+   sum, if given.
+*/
+class RecoveryWriter
+{
+public:
+  RecoveryWriter(const int _fd,
+                 const BatchPlan & plan,
+                 const int share,
+                 EVP_MD_CTX * _sum)
+    : fd(_fd)
+    , lo(plan.lo)
+    , hi(plan.hi)
+    , base(lseek(_fd, 0, SEEK_CUR))
+    , sum(_sum)
+    {
+      struct stat st;
+      inPlace = ((base >= 0) &&
+                 !(fcntl(fd, F_GETFL) & O_APPEND) &&
+                 !fstat(fd, &st) && S_ISREG(st.st_mode));
+      const off_t pos = lseek(share, 0, SEEK_CUR);
+      if (inPlace && !fstat(share, &st) && (pos >= 0) && (st.st_size > pos))
+      {
+        // no more than the range wanted, the share being at the first
+        // stripe of the plan
+        const off_t total = plan.origin +
+          ((st.st_size - pos) / plan.recordSize) * plan.outSize;
+        const off_t size = std::min(total - std::min(total, lo), hi - lo);
+        if (size > 0)
+        {
+          posix_fallocate(fd, base, size);
+        }
+      }
+    }
+
+  /// may stripes be written out of order?
+  bool random() const
+    {
+      return inPlace;
+    }
+
+  /// write the wanted part of [from, to) of the recovered data
+  void put(const uint8_t * buff, const off_t from, const off_t to) const
+    {
+      const off_t a = std::max(from, lo);
+      const off_t b = std::min(to, hi);
+      if (a >= b)
+      {
+        return;
+      }
+      if (inPlace)
+      {
+        pwriteFully(fd, buff + (a - from), b - a, base + (a - lo));
+        return;
+      }
+      writeFully(fd, buff + (a - from), b - a);
+    }
+
+  /// write the wanted part of count whole stripes of the numData rows,
+  /// from from of the recovered data, straight from the rows
+  void gather(const std::vector<uint8_t *> & rows,
+              const int numData,
+              const size_t count,
+              const off_t from)
+    {
+      std::vector<struct iovec> iov;
+      // where the next block goes, and where the first piece written does
+      off_t at = from;
+      off_t start = -1;
+      for (size_t stripe = 0; stripe < count; ++stripe)
+      {
+        for (int idx = 0; idx < numData; ++idx)
+        {
+          const off_t len = (idx + 1 < numData) ? BLOCKSIZE : (BLOCKSIZE - 1);
+          const off_t a = std::max(at, lo);
+          const off_t b = std::min(at + len, hi);
+          if (a < b)
+          {
+            start = (start < 0) ? a : start;
+            uint8_t * p = rows[idx] + (stripe * BLOCKSIZE) + (a - at);
+            iov.push_back({ p, (size_t)(b - a) });
+            hash(p, b - a);
+          }
+          at += len;
+        }
+      }
+      if (!iov.empty())
+      {
+        writevFully(fd, iov, inPlace ? (base + (start - lo)) : -1);
+      }
+    }
+
+  /// add len bytes at buff, in order, to the checksum of the data
+  void hash(const void * buff, const size_t len)
+    {
+      if (sum)
+      {
+        EVP_DigestUpdate(sum, buff, len);
+      }
+    }
+
+  /// leave the output at the end of the total bytes recovered
+  void finish(const off_t total)
+    {
+      if (inPlace)
+      {
+        attest(!ftruncate(fd, base + total), "ftruncate: %m");
+        lseek(fd, base + total, SEEK_SET);
+      }
+    }
+
+private:
+  const int   fd;
+  const off_t lo;
+  const off_t hi;
+  const off_t base;
+  bool        inPlace;
+  EVP_MD_CTX * sum;
+};
+
+/**
+   Decodes batches of stripes, each share's blocks in a contiguous
+   row, and hands the data to a RecoveryWriter.
+
+   gfm.recover() decodes a whole run of stripes in one call. The
+   batch is split between threads that decode their run and pack it
+   into the output buffer, each stripe less its padding flag. When the
+   output can be written out of order the threads write their own
+   stripes, otherwise the batch is written once they're all done.
+
+   When the batch was read from all the data shares there's nothing
+   to decode: that's the fast path, the batch is written with one
+   writev() (or pwritev()) straight from the rows, skipping the
+   threads and the copy into the output buffer.
+
+   The last stripe of a batch is decoded but carried over to the next
+   one until a short read shows whether it is the final (padded) one.
+*/
+class BatchDecoder
+{
+public:
+  BatchDecoder(GFM & _gfm,
+               const uint8_t _numData,
+               const uint8_t numParity,
+               const BatchPlan & _plan,
+               RecoveryWriter & _writer)
+    : gfm(_gfm)
+    , numData(_numData)
+    , plan(_plan)
+    , writer(_writer)
+    , recovery(_numData, numParity)
+    , out(_plan.batch * _plan.outSize)
+    , held(_plan.stripeSize)
+    {
+    }
+
+  /// put the stripe carried over into the first stripe of the rows
+  void restore(const std::vector<uint8_t *> & rows) const
+    {
+      for (int idx = 0; idx < numData; ++idx)
+      {
+        memcpy(rows[idx], &held[idx * BLOCKSIZE], BLOCKSIZE);
+      }
+    }
+
+  /// carry the (decoded) stripe of the rows over to the next batch
+  void carry(const std::vector<uint8_t *> & rows, const size_t stripe)
+    {
+      for (int idx = 0; idx < numData; ++idx)
+      {
+        memcpy(&held[idx * BLOCKSIZE], rows[idx] + (stripe * BLOCKSIZE),
+               BLOCKSIZE);
+      }
+    }
+
+  /**
+     Decode stripes [carried, have) of the rows from the shares used,
+     and write the first emit of them, from from of the data. With
+     last the final one is padded. Returns the bytes written.
+  */
+  size_t emit(const std::vector<uint8_t *> & rows,
+              const std::vector<bool> & used,
+              const size_t carried,
+              const size_t have,
+              const size_t emit,
+              const bool last,
+              const off_t from)
+    {
+      const size_t outSize = plan.outSize;
+      // with all the data shares read there's nothing to decode
+      const bool direct = std::all_of(used.begin(), used.begin() + numData,
+                                      [](const bool b) { return b; });
+      // where the final stripe is packed
+      uint8_t * tail = &out[(emit - 1) * outSize];
+      if (direct)
+      {
+        // write the stripes straight from the rows, all but a final one
+        writer.gather(rows, numData, last ? (emit - 1) : emit, from);
+        if (last)
+        {
+          tail = out.data();
+          pack(rows, emit - 1, tail);
+        }
+      }
+      else
+      {
+        decode(rows, used, carried, have, emit, from);
+      }
+
+      size_t numToWrite = emit * outSize;
+      if (last)
+      {
+        // drop the final stripe's padding
+        // (copied to keep removePadding()'s 32-bit read aligned)
+        std::vector<uint8_t> final(tail, tail + outSize);
+        final.push_back(rows[numData - 1][(emit * BLOCKSIZE) - 1]);
+        numToWrite -= outSize - removePadding(final.data(), plan.stripeSize);
+      }
+      if (direct && last)
+      {
+        const off_t at = from + ((emit - 1) * outSize);
+        const size_t len = numToWrite - ((emit - 1) * outSize);
+        writer.put(tail, at, at + len);
+        writer.hash(tail, len);
+      }
+      else if (!direct)
+      {
+        if (!writer.random())
+        {
+          writer.put(out.data(), from, from + numToWrite);
+        }
+        writer.hash(out.data(), numToWrite);
+      }
+      return numToWrite;
+    }
+
+private:
+  // pack stripe of the rows into dst, less its padding flag
+  void pack(const std::vector<uint8_t *> & rows,
+            const size_t stripe,
+            uint8_t * dst) const
+    {
+      for (int idx = 0; idx < numData; ++idx)
+      {
+        memcpy(dst + (idx * BLOCKSIZE), rows[idx] + (stripe * BLOCKSIZE),
+               (idx + 1 < numData) ? BLOCKSIZE : (BLOCKSIZE - 1));
+      }
+    }
+
+  // decode the rows on several threads, packing the stripes to be
+  // emitted into out (and writing them, if they can be out of order)
+  void decode(const std::vector<uint8_t *> & rows,
+              const std::vector<bool> & used,
+              const size_t carried,
+              const size_t have,
+              const size_t emit,
+              const off_t from)
+    {
+      const size_t outSize = plan.outSize;
+      uint8_t ** rcvr = recovery(used);
+      // decode stripes [first, end) and pack those to be emitted
+      auto run = [&](const size_t first, const size_t end)
+        {
+          const size_t start = std::max(first, carried);
+          if (start < end)
+          {
+            std::vector<uint8_t *> part(rows);
+            for (uint8_t * & row : part)
+            {
+              row = row ? row + (start * BLOCKSIZE) : nullptr;
+            }
+            gfm.recover(part.data(), rcvr, (end - start) * BLOCKSIZE);
+          }
+          const size_t to = std::min(end, emit);
+          for (size_t stripe = first; stripe < to; ++stripe)
+          {
+            pack(rows, stripe, &out[stripe * outSize]);
+          }
+          if (writer.random() && (first < to))
+          {
+            writer.put(&out[first * outSize], from + (first * outSize),
+                       from + (to * outSize));
+          }
+        };
+
+      const unsigned numThreads = plan.numThreads;
+      const size_t slice = (have + numThreads - 1) / numThreads;
+      std::vector<Thread> workers;
+      for (size_t first = 0; (first < have) && (numThreads > 1);
+           first += slice)
+      {
+        const size_t to = std::min(have, first + slice);
+        workers.emplace_back([&, first, to]() { run(first, to); });
+      }
+      if (numThreads == 1)
+      {
+        run(0, have);
+      }
+      JoinAll(workers);
+    }
+
+  GFM & gfm;
+  const uint8_t numData;
+  const BatchPlan & plan;
+  RecoveryWriter & writer;
+  // a recovery matrix for each combination of shares used
+  RecoveryCache recovery;
+  // the packed data of a batch
+  std::vector<uint8_t> out;
+  // the decoded stripe carried over
+  std::vector<uint8_t> held;
+};
+
+/**
+   Recover from the open shares, a batch of stripes at a time.
+
+   The stripes of the BatchPlan are read by a ReaderPool, each share's
+   blocks for the batch into a contiguous row, which a BatchDecoder
+   decodes and hands to a RecoveryWriter.
+
+   Blocks that fail their CRC32C (with crc) or are corrupt (with
+   options.correct) are fixed by a BatchCorrector before decoding.
+
+   Given the stub, what's read is checked by a ManifestCheck.
+*/
+void RecoverData(const int fd,
+                 const uint8_t numData,
+                 const uint8_t numParity,
+                 GFM & gfm,
+                 const int * fds,
+                 const RecoveryOptions & options,
+                 const bool crc,
+                 const int * spares,
+                 const std::string & stub = std::string())
+{
+  const int numShares = numData + numParity;
+  const BatchPlan plan(numData, crc, options);
+  ManifestCheck manifest(stub, plan, options);
+  ReaderPool pool(numData, numParity, fds, spares, crc, plan,
+                  options.correct, manifest.hashShares());
+  BatchCorrector corrector(gfm, numData, numParity, fds, spares, plan,
+                           options.correct, pool.isHedged());
+
+  RecoveryWriter writer(fd, plan,
+                        *std::find_if(fds, fds + numShares,
+                                      [](const int f) { return f >= 0; }),
+                        manifest.data());
+  BatchDecoder decoder(gfm, numData, numParity, plan, writer);
+
+  // the set of rows being decoded
+  int cur = 0;
+  // stripes in the rows, the first may have been carried over
+  size_t have = 0;
+  // stripes recovered so far
+  size_t done = 0;
+  // bytes recovered so far
+  off_t total = 0;
+  // read the first batch
+  size_t want = plan.first();
+  pool.post(cur, 0, 0, want);
+  // the next stripe to read
+  size_t next = want;
+  while (true)
+  {
+    std::vector<bool> used;
+    std::vector<bool> got;
+    const size_t numRead = pool.collect(cur, used, got);
+    // the rows to decode from and into
+    const std::vector<uint8_t *> rows = pool.rows(cur, used);
+    corrector.fix(plan.firstStripe + done, rows, pool.read(cur),
+                  pool.bad(cur), used, got, have, numRead);
+    // stripes before this have been decoded
+    const size_t carried = have;
+    if (carried)
+    {
+      decoder.restore(rows);
+    }
+    have += numRead;
+    const bool last = (numRead != want);
+    attest(have || plan.firstStripe, "no data in shares");
+    if (!have)
+    {
+      // offset past the end
+      break;
+    }
+    const size_t emit = last ? have : (have - 1);
+
+    // start reading the next batch into the other rows while this one
+    // is decoded
+    const bool more = !last && plan.more(done + emit);
+    if (more)
+    {
+      want = plan.next(done + emit);
+      pool.post(!cur, 1, next, want);
+      next += want;
+    }
+
+    const off_t from = plan.origin + (done * plan.outSize);
+    const size_t numToWrite =
+      decoder.emit(rows, used, carried, have, emit, last, from);
+    done  += emit;
+    total  = std::max((off_t)0,
+                      std::min(from + (off_t)numToWrite, plan.hi) - plan.lo);
+
+    if (!more)
+    {
+      break;
+    }
+    // carry the last, decoded, stripe over
+    decoder.carry(rows, emit);
+    cur  = !cur;
+    have = 1;
+  }
+  // stop any late shares
+  pool.finish();
+  manifest.check(pool, numShares);
+
+  writer.finish(total);
+
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    close(fds[idx]);
+  }
+}
+
+/**
+   List the shares of base in directory dir by their number, skipping
+   numbers already in names[]. Returns false if dir can't be read.
+*/
+static bool ScanShares(const std::string & dir,
+                       const std::string & base,
+                       std::vector<std::string> & names)
+{
+  DIR * d = opendir(dir.empty() ? "." : dir.c_str());
+  if (!d)
+  {
+    return false;
+  }
+  const std::string prefix(base + "_");
+  while (const struct dirent * entry = readdir(d))
+  {
+    const std::string name(entry->d_name);
+    if ((name.size() != (prefix.size() + 6)) ||
+        name.compare(0, prefix.size(), prefix) ||
+        !ends_with(name, ".tar"))
+    {
+      continue;
+    }
+    const std::string num(name.substr(prefix.size(), 2));
+    if (!isxdigit(num[0]) || !isxdigit(num[1]))
+    {
+      continue;
+    }
+    const unsigned long idx = strtoul(num.c_str(), nullptr, 16);
+    // only the names MakeFilename() would have made
+    if ((idx < names.size()) && names[idx].empty() &&
+        (name == MakeFilename(base, idx)))
+    {
+      names[idx] = dir + name;
+    }
+  }
+  closedir(d);
+  return true;
+}
+
+/**
+   Open every available share of the stub, leaving the fds of
+   unavailable ones negative. Returns the number of shares found.
+
+   Shares are looked for next to the stub, then in each of the search
+   directories, the first found of each number being used. The
+   directories are scanned rather than trying all 250 names, and the
+   shares found are opened and their signatures read in parallel so
+   the latencies of slow disks and mounts overlap.
+
+   Share files named explicitly (pipes, "/dev/fd/N" etc) are numbered
+   by their signatures, and take the place of any found otherwise.
+*/
+static int FindShares(const std::string & stub,
+                      int * fds,
+                      signature & sig,
+                      const std::vector<std::string> & search =
+                      std::vector<std::string>(),
+                      const std::vector<std::string> & files =
+                      std::vector<std::string>())
+{
+  const size_t slash = stub.rfind('/');
+  const std::string base((slash == std::string::npos) ? stub :
+                         stub.substr(slash + 1));
+  std::vector<std::string> names(250);
+  if (!ScanShares((slash == std::string::npos) ? "" :
+                  stub.substr(0, slash + 1), base, names))
+  {
+    // unreadable directory, try all the names
+    for (int idx = 0; idx < 250; ++idx)
+    {
+      names[idx] = MakeFilename(stub, idx);
+    }
+  }
+  for (std::string dir : search)
+  {
+    if (!ends_with(dir, "/"))
+    {
+      dir += "/";
+    }
+    if (!ScanShares(dir, base, names))
+    {
+      std::cerr << "unable to search \"" << dir << "\": "
+                << strerror(errno) << std::endl;
+    }
+  }
+
+  std::vector<signature> chks(250);
+  std::vector<int> given(files.size(), -1);
+  std::vector<signature> givenChks(files.size());
+  std::vector<Thread> probes;
+  for (int idx = 0; idx < 250; ++idx)
+  {
+    fds[idx] = - __LINE__;
+    if (!names[idx].empty())
+    {
+      probes.emplace_back([&names, &chks, fds, idx]()
+                          { fds[idx] = ProbeFile(names[idx], chks[idx]); });
+    }
+  }
+  for (size_t pos = 0; pos < files.size(); ++pos)
+  {
+    probes.emplace_back([&files, &given, &givenChks, pos]()
+                        { given[pos] = ProbeFile(files[pos], givenChks[pos]); });
+  }
+  JoinAll(probes);
+  std::set<int> taken;
+  for (size_t pos = 0; pos < files.size(); ++pos)
+  {
+    const int idx = givenChks[pos].fileNum;
+    attest(given[pos] >= 0, "unable to read a share from %s",
+           files[pos].c_str());
+    attest((idx < 250) && taken.insert(idx).second,
+           "%s: share %02x given twice", files[pos].c_str(), idx);
+    if (fds[idx] >= 0)
+    {
+      close(fds[idx]);
+    }
+    fds[idx]   = given[pos];
+    chks[idx]  = givenChks[pos];
+    names[idx] = files[pos];
+  }
+
+  // use this to make sure all the files have the same
+  // parameters
+  signature expected = {
+    .numData      = 0,
+    .numParity    = 0,
+    .fileNum      = 0,
+    .blocksizePo2 = 0,
+  };
+  // numParity is the most of any share
+  sig = {
+    .numData      = 255,
+    .numParity    = 255,
+    .fileNum      = 0,
+    .blocksizePo2 = BLOCKSIZE_Po2,
+  };
+
+  for (int idx = 0; idx < 250; ++idx)
+  {
+    if (fds[idx] < 0)
+    {
+      continue;
+    }
+    sig.fileNum = idx;
+    const std::string & filename = names[idx];
+    if (!CheckSignature(sig, chks[idx]))
+    {
+      close(fds[idx]);
+      fds[idx] = - __LINE__;
+      continue;
+    }
+    if (!expected.fileNum++)
+    {
+      expected.numData      = sig.numData;
+      expected.blocksizePo2 = sig.blocksizePo2;
+      continue;
+    }
+
+    attest(expected.numData   == sig.numData,
+           "signature.numData inconsistent: %s",
+           filename.c_str());
+    attest(expected.blocksizePo2 == sig.blocksizePo2,
+           "signature.blocksizePo2 inconsistent: %s",
+           filename.c_str());
+  }
+  return expected.fileNum;
+}
+
+/**
+   Measure how fast a share reads, in bytes per second, without
+   moving its file offset.
+*/
+static double ReadSpeed(const int fd)
+{
+  static const size_t PROBE_SIZE = 1 << 20;
+  std::vector<uint8_t> buff(PROBE_SIZE);
+  const off_t off = lseek(fd, 0, SEEK_CUR);
+  const auto start = std::chrono::steady_clock::now();
+  const ssize_t rc = pread(fd, buff.data(), buff.size(), off);
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  if (rc <= 0)
+  {
+    return 0;
+  }
+  return rc / std::max(elapsed.count(), 1e-9);
+}
+
+/**
+   Choose the shares to recover from and close the rest.
+   Shares named in options.prefer go first. The rest follow by
+   measured read speed if options.fastest, otherwise data shares
+   before parity shares: a data share's row of the recovery matrix
+   is pass-through, so every one used is one less row to decode.
+   options.hedge more are kept to hedge against slow shares, all of
+   them if options.correct.
+   The rest are moved to spares (if given) to fall back on.
+*/
+static void ChooseShares(int * fds,
+                         const uint8_t numData,
+                         const uint8_t numParity,
+                         const RecoveryOptions & options,
+                         int * spares = nullptr)
+{
+  const int numShares = numData + numParity;
+  std::vector<int> ranked;
+  for (const uint8_t idx : options.prefer)
+  {
+    attest(idx < numShares, "no share %02x, there are only %d",
+           (unsigned)idx, numShares);
+    if ((fds[idx] >= 0) &&
+        (std::find(ranked.begin(), ranked.end(), idx) == ranked.end()))
+    {
+      ranked.push_back(idx);
+    }
+  }
+
+  std::vector<int> rest;
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    if ((fds[idx] >= 0) &&
+        (std::find(ranked.begin(), ranked.end(), idx) == ranked.end()))
+    {
+      rest.push_back(idx);
+    }
+  }
+  if (options.fastest)
+  {
+    std::vector<double> speed(numShares, 0);
+    for (const int idx : rest)
+    {
+      speed[idx] = ReadSpeed(fds[idx]);
+    }
+    std::stable_sort(rest.begin(), rest.end(),
+                     [&speed](const int a, const int b)
+                     { return speed[a] > speed[b]; });
+  }
+  ranked.insert(ranked.end(), rest.begin(), rest.end());
+
+  std::cerr << "using shares";
+  for (size_t pos = 0; pos < ranked.size(); ++pos)
+  {
+    const int idx = ranked[pos];
+    if (options.correct || (pos < (size_t)(numData + options.hedge)))
+    {
+      std::cerr << ' ' << std::setw(2) << std::setfill('0')
+                << std::hex << idx << std::dec;
+      continue;
+    }
+    if (spares)
+    {
+      spares[idx] = fds[idx];
+    }
+    else
+    {
+      close(fds[idx]);
+    }
+    fds[idx] = - __LINE__;
+  }
+  std::cerr << std::endl;
+}
+
+/**
+   Recover given the filename stub to the given file descriptor, or if
+   it's negative to output, opened only once there are shares to
+   recover from.
+*/
+static void RecoverData(const std::string & stub,
+                        int fd,
+                        const RecoveryOptions & options,
+                        const std::string & output = "")
+{
+  int fds[250] = {0,};
+  signature sig;
+
+  // did we manage to open any files?
+  attest(FindShares(stub, fds, sig, options.search, options.shares),
+         "Unable to find any shares of \"%s\"", stub.c_str());
+
+  const uint8_t numData   = sig.numData;
+  const uint8_t numParity = sig.numParity;
+  const bool    crc       = sig.blocksizePo2 & BLOCK_CRC;
+
+  // keep the other shares for bad blocks and failed shares
+  int spares[250];
+  std::fill(spares, spares + 250, -1);
+  ChooseShares(fds, numData, numParity, options, spares);
+
+  GFM gfm(numData, numParity);
+
+  for (int idx = 0; idx < (numData + numParity); ++idx)
+  {
+    if (fds[idx] < 0)
+    {
+      gfm.failData(idx);
+    }
+  }
+
+  const bool opened = (fd < 0);
+  if (opened)
+  {
+    fd = (output == "-") ? STDOUT_FILENO :
+      open(output.c_str(),
+           O_WRONLY | O_CREAT | O_TRUNC,
+           S_IRUSR | S_IWUSR);
+    attest(fd != -1, "open(%s,WRONLY): %m", output.c_str());
+  }
+
+  // now that we have opened all the files, start the recovery.
+  RecoverData(fd, numData, numParity, gfm, fds, options, crc, spares, stub);
+  if (opened)
+  {
+    close(fd);
+  }
+}
+
+/**
+   Recover given the filename stub to the given output file,
+   "-" being STDOUT.
+*/
+void RecoverData(const std::string & stub,
+                 const std::string & output,
+                 const RecoveryOptions & options)
+{
+  RecoverData(stub, -1, options, output);
+}
+
+/**
+   Clean up after a --reshare that was interrupted. The old shares are
+   moved aside to "*.old" one by one, then the old manifest, marking
+   them all aside, then the new shares are moved into place and the new
+   manifest last. Until then the old shares are put back, after it
+   what's left of them is removed. Either way no mix of old and new
+   shares is left under the share names.
+*/
+static void ResumeReshare(const std::string & stub,
+                          const std::string & suffix,
+                          const std::string & aside,
+                          const bool interrupted = true)
+{
+  const std::string manifest = stub + ".sha256";
+  const bool setAside = !access((manifest + aside).c_str(), F_OK);
+  const bool complete = access((manifest + suffix).c_str(), F_OK);
+  if (!setAside && complete)
+  {
+    // nothing to do
+    return;
+  }
+  if (interrupted)
+  {
+    std::cerr << (complete ? "finishing" : "undoing")
+              << " an interrupted reshare of " << stub << std::endl;
+  }
+  for (int idx = 0; idx < 250; ++idx)
+  {
+    const std::string filename = MakeFilename(stub, idx);
+    unlink((filename + suffix).c_str());
+    if (complete)
+    {
+      unlink((filename + aside).c_str());
+      continue;
+    }
+    if (setAside)
+    {
+      // any share in place is a new one
+      unlink(filename.c_str());
+    }
+    if (!access((filename + aside).c_str(), F_OK))
+    {
+      attest(!rename((filename + aside).c_str(), filename.c_str()),
+             "rename(%s): %m", filename.c_str());
+    }
+  }
+  unlink((manifest + suffix).c_str());
+  if (setAside && !complete)
+  {
+    attest(!rename((manifest + aside).c_str(), manifest.c_str()),
+           "rename(%s): %m", manifest.c_str());
+    // there wasn't one, just the mark
+    struct stat st;
+    if (!stat(manifest.c_str(), &st) && !st.st_size)
+    {
+      unlink(manifest.c_str());
+    }
+  }
+  unlink((manifest + aside).c_str());
+}
+
+/**
+   Re-split the stub into shares with a new geometry in a single pass,
+   recovering from the old shares on one thread and feeding the data
+   through a pipe to the new shares on another. The new shares are
+   written to temporary files that replace the old ones once complete,
+   see ResumeReshare().
+*/
+void ReshareData(const uint8_t numData,
+                 const uint8_t numParity,
+                 const std::string & stub)
+{
+  const std::string suffix(".reshare");
+  const std::string aside(".old");
+  ResumeReshare(stub, suffix, aside);
+
+  // note the old shares, to remove those not replaced
+  int fds[250] = {0,};
+  signature sig;
+  const int found = FindShares(stub, fds, sig);
+  for (int idx = 0; idx < 250; ++idx)
+  {
+    close(fds[idx]);
+  }
+  attest(found, "Unable to find any shares of \"%s\"", stub.c_str());
+
+  int pipefd[2];
+  attest(!pipe(pipefd), "pipe: %m");
+  Thread recovery([&]()
+    {
+      try
+      {
+        RecoverData(stub, pipefd[1], RecoveryOptions());
+      }
+      catch (...)
+      {
+        // end the new shares short, they're not used
+        close(pipefd[1]);
+        throw;
+      }
+      close(pipefd[1]);
+    });
+  try
+  {
+    try
+    {
+      CreateParity(numData, numParity, stub, pipefd[0], suffix,
+                   sig.blocksizePo2 & BLOCK_CRC);
+    }
+    catch (...)
+    {
+      // stop the recovery, it gets EPIPE, then report what went wrong
+      close(pipefd[0]);
+      try
+      {
+        recovery.join();
+      }
+      catch (...)
+      {
+      }
+      throw;
+    }
+    recovery.join();
+  }
+  catch (...)
+  {
+    // drop the incomplete new shares
+    ResumeReshare(stub, suffix, aside, false);
+    throw;
+  }
+
+  // set the old shares aside ...
+  for (int idx = 0; idx < 250; ++idx)
+  {
+    if (fds[idx] >= 0)
+    {
+      const std::string filename = MakeFilename(stub, idx);
+      attest(!rename(filename.c_str(), (filename + aside).c_str()),
+             "rename(%s): %m", filename.c_str());
     }
   }
+  // ... all of them, with the manifest (or an empty one) to say so
+  const std::string manifest = stub + ".sha256";
+  if (rename(manifest.c_str(), (manifest + aside).c_str()))
+  {
+    attest(errno == ENOENT, "rename(%s): %m", manifest.c_str());
+    const int mark = open((manifest + aside).c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    attest(mark >= 0, "open(%s): %m", (manifest + aside).c_str());
+    close(mark);
+  }
+  // move the new shares in ...
+  for (int idx = 0; idx < (numData + numParity); ++idx)
+  {
+    const std::string filename = MakeFilename(stub, idx);
+    attest(!rename((filename + suffix).c_str(), filename.c_str()),
+           "rename(%s): %m", filename.c_str());
+  }
+  // ... the new manifest completing them ...
+  attest(!rename((manifest + suffix).c_str(), manifest.c_str()),
+         "rename(%s): %m", manifest.c_str());
+  // ... and only then drop the old ones
+  ResumeReshare(stub, suffix, aside, false);
 }
 
-
-int OpenFile(const std::string & filename,
-             signature & sig)
+/**
+   Write the given missing shares of the stub, calculated from numData
+   of the others: recover the missing data rows and re-calculate the
+   missing parity rows a batch of stripes at a time. The new shares
+   get a surviving share's header (tarball and all) with fileNum and
+   the given numParity patched, and the .sha256 manifest is updated to
+   match.
+*/
+static void RebuildShares(const std::string & stub,
+                          int * fds,
+                          const uint8_t numData,
+                          const uint8_t numParity,
+                          const bool crc,
+                          const std::map<int, uint8_t> & rebuild)
 {
-  int fd = open(filename.c_str(), O_RDONLY);
-  if (fd < 0)
+  const int numShares = numData + numParity;
+  std::vector<int> missing;
+  for (const auto & share : rebuild)
   {
-    return - __LINE__;
+    missing.push_back(share.first);
+  }
+  int spares[250];
+  std::fill(spares, spares + 250, -1);
+  ChooseShares(fds, numData, numParity, RecoveryOptions(),
+               crc ? spares : nullptr);
+  BlockFixer fixer(numData, numParity, spares);
+  GFM gfm(numData, numParity);
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    if (fds[idx] < 0)
+    {
+      gfm.failData(idx);
+    }
   }
+  uint8_t ** rcvr = gfm.recovery();
 
-  off_t off = lseek(fd, 124, SEEK_SET);
-  attest((off == 124),
-         "unable to seek to file size in tar header");
+  // copy the header of a surviving share
+  const int share = *std::find_if(fds, fds + numShares,
+                                  [](const int f) { return f >= 0; });
+  const off_t headerSize = lseek(share, 0, SEEK_CUR);
+  std::vector<uint8_t> header(headerSize);
+  attest(pread(share, header.data(), headerSize, 0) == headerSize,
+         "unable to read share header: %m");
+  const uint32_t sigOffset = SignatureOffset(share);
 
-  char buff[12];
-  ssize_t rc = read(fd, buff, 11);
-  attest((rc == (ssize_t)11),
-         "unable to read file size from tar header");
-  buff[11] = '\0';
+  std::vector<std::string> filename(numShares);
+  std::vector<EVP_MD_CTX *> ctx(numShares, nullptr);
+  std::vector<int> out(numShares, -1);
+  for (const int idx : missing)
+  {
+    filename[idx] = MakeFilename(stub, idx);
+    std::cerr << "rebuilding " << filename[idx] << std::endl;
+    out[idx] = open(filename[idx].c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR);
+    attest(out[idx] != -1, "Unable to open file: '%s': %m",
+           filename[idx].c_str());
+    ctx[idx] = EVP_MD_CTX_create();
+    attest(ctx[idx] != nullptr,
+           "Unable to create context for [%d]", idx);
+    EVP_DigestInit_ex(ctx[idx], EVP_sha256(), 0);
 
-  char * endptr = 0;
-  uint32_t s = strtol(buff, &endptr, 8);
-  attest(endptr && (*endptr == '\0'),
-         "unable to decode file size from tar header");
-  s += 0x200;
-  off = lseek(fd, s, SEEK_SET);
-  attest((s == (uint32_t)off),
-         "unable to seek to end of tar-blob");
+    header[sigOffset + offsetof(signature, numParity)] = rebuild.at(idx);
+    header[sigOffset + offsetof(signature, fileNum)]   = idx;
+    writeFully(out[idx], header.data(), headerSize);
+    EVP_DigestUpdate(ctx[idx], header.data(), headerSize);
+  }
 
-  signature chk;
-  rc = read(fd, &chk, sizeof(chk));
-  attest((rc == sizeof(chk)),
-         "unable to read signature block");
-  // might not know numData yet either...
-  if (sig.numData == 255)
+  // rows for all the shares, a batch of blocks at a time
+  const size_t batch =
+    std::max((size_t)1, (size_t)(16 << 20) / (numShares * BLOCKSIZE));
+  uint8_t ** rows = GFM::makeArray(numShares, batch * BLOCKSIZE);
+  std::vector<std::vector<uint8_t>> bad(numShares,
+                                        std::vector<uint8_t>(batch));
+  size_t done = 0;
+  bool last = false;
+  while (!last)
   {
-    sig.numData   = chk.numData;
-    sig.numParity = chk.numParity;
+    ssize_t numRead = -1;
+    for (int idx = 0; idx < numShares; ++idx)
+    {
+      if (fds[idx] < 0)
+      {
+        continue;
+      }
+      const ssize_t rc =
+        ReadBlocks(fds[idx], rows[idx], batch, crc, bad[idx].data());
+      attest((numRead < 0) || (rc == numRead),
+             "share %02x is truncated", idx);
+      numRead = rc;
+    }
+    last = (numRead != (ssize_t)batch);
+
+    // fix any bad blocks
+    for (ssize_t stripe = 0; stripe < numRead; ++stripe)
+    {
+      std::vector<uint8_t *> blocks(numShares, nullptr);
+      std::vector<bool> bads(numShares, false);
+      bool any = false;
+      for (int idx = 0; idx < numShares; ++idx)
+      {
+        if (fds[idx] >= 0)
+        {
+          blocks[idx] = rows[idx] + (stripe * BLOCKSIZE);
+          bads[idx] = bad[idx][stripe];
+          any |= bads[idx];
+        }
+      }
+      if (any)
+      {
+        fixer.fix(done + stripe, blocks, bads);
+      }
+    }
+    done += numRead;
+
+    gfm.recover(rows, rcvr, numRead * BLOCKSIZE);
+    for (const int idx : missing)
+    {
+      if (idx >= numData)
+      {
+        gfm.parity(rows, numRead * BLOCKSIZE, idx);
+      }
+      WriteBlocks(out[idx], rows[idx], numRead, crc, ctx[idx]);
+    }
   }
-  else
+  free(rows);
+  free(rcvr);
+
+  // update the manifest
+  const std::string manifest = stub + ".sha256";
+  std::vector<std::string> lines = ReadManifest(stub);
+  for (const int idx : missing)
   {
-    // numParity not known at this stage, so cheat
-    chk.numParity = sig.numParity;
+    close(out[idx]);
+    const std::string line = FormatMD(filename[idx], ctx[idx]);
+    auto it = FindMD(lines, line);
+    if (it == lines.end())
+    {
+      lines.push_back(line);
+      continue;
+    }
+    if (*it != line)
+    {
+      std::cerr << "manifest entry for " << filename[idx]
+                << " changed" << std::endl;
+    }
+    *it = line;
   }
-  // check that
-  if (memcmp(&sig, &chk, sizeof(sig)))
+  FILE * md5File = fopen(manifest.c_str(), "w");
+  attest(md5File, "Unable to open MD file: '%s'", manifest.c_str());
+  for (const std::string & line : lines)
   {
-    close(fd);
-    return - __LINE__;
+    fputs(line.c_str(), md5File);
   }
+  fclose(md5File);
 
-  // see to next BLOCKSIZE boundary
-  off += sizeof(signature) + BLOCKSIZE - 1;
-  off &= ~(BLOCKSIZE - 1);
-  attest((lseek(fd, off, SEEK_SET) == off),
-         "unable to seek to end of tar-blob (0x%zx): %m", off);
-
-  return fd;
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    close(fds[idx]);
+  }
 }
 
-int OpenFile(const std::string & filename,
-             const uint8_t idx,
-             GFM & gfm,
-             signature & sig)
+// the manifest line for all of fd, read without moving its offset
+static std::string HashShare(const int fd, const std::string & filename)
 {
-  int fd = OpenFile(filename, sig);
-  if (fd >= 0)
+  EVP_MD_CTX * ctx = EVP_MD_CTX_create();
+  EVP_DigestInit_ex(ctx, EVP_sha256(), 0);
+  std::vector<uint8_t> buff(1 << 20);
+  off_t off = 0;
+  ssize_t rc;
+  while ((rc = pread(fd, buff.data(), buff.size(), off)) > 0)
   {
-    return fd;
+    EVP_DigestUpdate(ctx, buff.data(), rc);
+    off += rc;
   }
-  gfm.failData(idx);
-  return - __LINE__;;
+  return FormatMD(filename, ctx);
 }
 
-void RecoverData(const int fd,
-                 const uint8_t numData,
-                 const uint8_t numParity,
-                 GFM & gfm,
-                 const int * fds)
+/**
+   Rebuild the damaged shares of the stub from numData of the others,
+   without recovering the data. A share is damaged if it's missing,
+   if its signature doesn't match the set's, or if it doesn't match
+   the .sha256 manifest. Each existing file is named before it's
+   overwritten. The rebuilt shares are byte-for-byte what was lost.
+   If the shares were extended, each one's numParity is taken to be
+   the least of the survivors' that covers it.
+*/
+void RepairShares(const std::string & stub)
 {
-  uint8_t ** buff = GFM::makeArray(numData + numParity, BLOCKSIZE);
-  uint8_t ** rcvr = gfm.recovery();
+  int fds[250] = {0,};
+  signature sig;
+  attest(FindShares(stub, fds, sig),
+         "Unable to find any shares of \"%s\"", stub.c_str());
+  const uint8_t numData   = sig.numData;
+  const uint8_t numParity = sig.numParity;
+  const int numShares = numData + numParity;
 
-  while(1)
+  // check the shares against the manifest, reading them all at once
+  std::vector<std::string> manifest = ReadManifest(stub);
+  std::vector<std::string> sums(numShares);
+  std::vector<Thread> hashers;
+  for (int idx = 0; (idx < numShares) && !manifest.empty(); ++idx)
   {
-    memset(buff[0], 0, (numData + numParity) * BLOCKSIZE);
-
-    ssize_t numRead = 0;
-
-    for (int idx = 0; idx < (numData + numParity); ++idx)
+    if (fds[idx] >= 0)
     {
-      if (fds[idx] >= 0)
-      {
-        numRead += readFully(fds[idx], buff[idx], BLOCKSIZE);
-      }
+      hashers.emplace_back([&sums, &stub, fds, idx]()
+                           {
+                             sums[idx] = HashShare(fds[idx],
+                                                   MakeFilename(stub, idx));
+                           });
     }
-
-    if (numRead <= 0)
+  }
+  JoinAll(hashers);
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    const std::string filename = MakeFilename(stub, idx);
+    if ((fds[idx] >= 0) && !sums[idx].empty() && !CheckMD(manifest, sums[idx]))
     {
-      break;
+      std::cerr << filename << " doesn't match " << stub
+                << ".sha256, replacing it" << std::endl;
+      close(fds[idx]);
+      fds[idx] = - __LINE__;
+    }
+    else if ((fds[idx] < 0) && !access(filename.c_str(), F_OK))
+    {
+      std::cerr << filename << " isn't a valid share of the set, replacing it"
+                << std::endl;
     }
-    gfm.recover(buff, rcvr, BLOCKSIZE);
-
-    const size_t numToWrite = removePadding(buff[0], numData * BLOCKSIZE);
-
-    const size_t rc = write(fd, buff[0], numToWrite);
-    attest(rc == numToWrite, "Expected to write %zu, wrote %zd: %m", numToWrite, rc);
   }
+  const int numOpen = std::count_if(fds, fds + numShares,
+                                    [](const int f) { return f >= 0; });
+  attest(numOpen >= numData, "only %d of the %d shares needed",
+         numOpen, (int)numData);
 
-  for (int idx = 0; idx < (numData + numParity); ++idx)
+  std::set<uint8_t> parities;
+  for (int idx = 0; idx < numShares; ++idx)
   {
-    close(fds[idx]);
+    signature chk;
+    if ((fds[idx] >= 0) &&
+        (pread(fds[idx], &chk, sizeof(chk), SignatureOffset(fds[idx]))
+         == sizeof(chk)))
+    {
+      parities.insert(chk.numParity);
+    }
+  }
+  std::map<int, uint8_t> missing;
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    if (fds[idx] < 0)
+    {
+      missing[idx] = *std::find_if(parities.begin(), parities.end(),
+                                   [&](const uint8_t p)
+                                   { return idx < (numData + p); });
+    }
+  }
+  if (missing.empty())
+  {
+    std::cerr << "nothing to repair" << std::endl;
+    for (int idx = 0; idx < numShares; ++idx)
+    {
+      close(fds[idx]);
+    }
+    return;
   }
 
-  free(buff);
-  free(rcvr);
+  RebuildShares(stub, fds, numData, numParity,
+                sig.blocksizePo2 & BLOCK_CRC, missing);
 }
 
 /**
-   Recover given only the filename stub.
+   Add numNew parity shares to those of the stub. Parity rows don't
+   depend on how many of them there are, so the existing shares are
+   left as they are and recovery accepts the old and new together.
 */
-void RecoverData(const std::string & stub)
+void ExtendShares(const std::string & stub, const uint8_t numNew)
 {
   int fds[250] = {0,};
+  signature sig;
+  attest(FindShares(stub, fds, sig),
+         "Unable to find any shares of \"%s\"", stub.c_str());
+  const uint8_t numData   = sig.numData;
+  const int     numParity = sig.numParity + numNew;
+  attest(numData + numParity <= 250,
+         "Unable to create %i shares, limited to 250",
+         numData + numParity);
 
-  // use this to make sure all the files have the same
-  // parameters
-  signature expected = {
-    .numData      = 0,
-    .numParity    = 0,
-    .fileNum      = 0,
-    .blocksizePo2 = 0,
-  };
-  signature sig = {
-    .numData      = 255,
-    .numParity    = 255,
-    .fileNum      = 0,
-    .blocksizePo2 = BLOCKSIZE_Po2,
-  };
+  std::map<int, uint8_t> missing;
+  for (int idx = numData + sig.numParity; idx < numData + numParity; ++idx)
+  {
+    missing[idx] = numParity;
+  }
+  RebuildShares(stub, fds, numData, numParity,
+                sig.blocksizePo2 & BLOCK_CRC, missing);
+}
 
-  for (int idx = 0; idx < 250; ++idx)
+/**
+   Read up to numBlocks blocks from each open share into its row, each
+   share on its own thread, flagging blocks that fail their CRC in bad.
+   Returns the number of blocks read, which must be the same for all
+   the shares.
+*/
+static ssize_t ReadShares(const int * fds,
+                          uint8_t * const * rows,
+                          const int numShares,
+                          const size_t numBlocks,
+                          const bool crc,
+                          std::vector<std::vector<uint8_t>> & bad)
+{
+  std::vector<ssize_t> numRead(numShares, -1);
+  std::vector<Thread> readers;
+  for (int idx = 0; idx < numShares; ++idx)
   {
-    sig.fileNum = idx;
-    const std::string filename =  MakeFilename(stub, idx);
-    fds[idx] = OpenFile(filename, sig);
     if (fds[idx] >= 0)
     {
-      if (!expected.fileNum++)
-      {
-        expected.numData      = sig.numData;
-        expected.numParity    = sig.numParity;
-        expected.blocksizePo2 = sig.blocksizePo2;
-        continue;
-      }
-
-      attest(expected.numData   == sig.numData,
-             "signature.numData inconsistent: %s",
-             filename.c_str());
-      attest(expected.numParity == sig.numParity,
-             "signature.numParity inconsistent: %s",
-             filename.c_str());
-      attest(expected.blocksizePo2 == sig.blocksizePo2,
-             "signature.blocksizePo2 inconsistent: %s",
-             filename.c_str());
-      if (expected.fileNum < sig.numData)
-      {
-        continue;
-      }
-      for (++idx; idx < 250; ++idx)
-      {
-        fds[idx] = - __LINE__;
-      }
+      readers.emplace_back([&, idx]()
+        {
+          numRead[idx] = ReadBlocks(fds[idx], rows[idx], numBlocks,
+                                    crc, bad[idx].data());
+        });
     }
   }
-  // did we manage to open any files?
-  if (!expected.fileNum)
+  JoinAll(readers);
+  ssize_t ret = -1;
+  for (int idx = 0; idx < numShares; ++idx)
   {
-    std::cerr << "Unable to find any shares of \"" << stub << "\""
-              << std::endl;
-    exit(1);
+    if (fds[idx] < 0)
+    {
+      continue;
+    }
+    attest((ret < 0) || (numRead[idx] == ret),
+           "share %02x is truncated", idx);
+    ret = numRead[idx];
   }
+  return ret;
+}
 
+/**
+   Check the shares of the stub are consistent, without recovering
+   anything: recover the data from numData shares and re-calculate
+   the other shares' rows, a batch of stripes at a time spread over
+   all the cores. Stripes that don't check out are reported along
+   with the shares found to be bad, up to half the spare shares.
+   Returns true if all is well.
+*/
+bool VerifyShares(const std::string & stub)
+{
+  int fds[250] = {0,};
+  signature sig;
+  attest(FindShares(stub, fds, sig),
+         "Unable to find any shares of \"%s\"", stub.c_str());
   const uint8_t numData   = sig.numData;
   const uint8_t numParity = sig.numParity;
+  const bool    crc       = sig.blocksizePo2 & BLOCK_CRC;
+  const int numShares = numData + numParity;
+  bool ret = true;
 
-  GFM gfm(numData, numParity);
-
-  for (int idx = 0; idx < (numData + numParity); ++idx)
+  // shares must all be the same size, go with the most common
+  std::map<off_t, int> sizes;
+  std::vector<off_t> size(numShares, -1);
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    struct stat st;
+    if ((fds[idx] >= 0) && !fstat(fds[idx], &st))
+    {
+      ++sizes[size[idx] = st.st_size];
+    }
+  }
+  const off_t expected =
+    std::max_element(sizes.begin(), sizes.end(),
+                     [](const std::pair<off_t, int> & a,
+                        const std::pair<off_t, int> & b)
+                     { return a.second < b.second; })->first;
+  std::vector<int> avail;
+  for (int idx = 0; idx < numShares; ++idx)
   {
     if (fds[idx] < 0)
+    {
+      std::cout << "share " << std::setw(2) << std::setfill('0')
+                << std::hex << idx << std::dec << " is missing" << std::endl;
+      ret = false;
+      continue;
+    }
+    if (size[idx] != expected)
+    {
+      std::cout << "share " << std::setw(2) << std::setfill('0')
+                << std::hex << idx << std::dec << " is the wrong size"
+                << std::endl;
+      close(fds[idx]);
+      fds[idx] = - __LINE__;
+      ret = false;
+      continue;
+    }
+    avail.push_back(idx);
+  }
+  attest((int)avail.size() >= numData,
+         "only %zu of the %d shares needed", avail.size(), (int)numData);
+  if ((int)avail.size() == numData)
+  {
+    std::cout << "no spare shares to check against" << std::endl;
+    for (const int idx : avail)
+    {
+      close(fds[idx]);
+    }
+    return ret;
+  }
+
+  // recover from the first numData, check the rest
+  GFM gfm(numData, numParity);
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    if ((fds[idx] < 0) ||
+        (std::find(avail.begin(), avail.begin() + numData, idx) ==
+         avail.begin() + numData))
     {
       gfm.failData(idx);
     }
   }
-  const int fd = open(stub.c_str(),
-                      O_WRONLY | O_CREAT | O_TRUNC,
-                      S_IRUSR | S_IWUSR);
-  attest(fd != -1, "open(%s,WRONLY): %m", stub.c_str());
+  uint8_t ** rcvr = gfm.recovery();
+  const std::vector<int> check(avail.begin() + numData, avail.end());
 
-  // now that we have opened all the files, start the recovery.
-  RecoverData(fd, numData, numParity, gfm, fds);
+  const unsigned numThreads =
+    std::max(1u, std::thread::hardware_concurrency());
+  const size_t batch = std::max((size_t)1, ((size_t)numThreads << 21) /
+                                (numShares * BLOCKSIZE));
+  // rows as read, plus recovered data and re-calculated checks
+  uint8_t ** rows = GFM::makeArray(numShares, batch * BLOCKSIZE);
+  uint8_t ** calc = GFM::makeArray(numShares, batch * BLOCKSIZE);
+  std::vector<std::vector<uint8_t>> crcBad(numShares,
+                                           std::vector<uint8_t>(batch));
+
+  size_t done = 0;
+  size_t numBad = 0;
+  bool last = false;
+  while (!last)
+  {
+    const ssize_t numRead =
+      ReadShares(fds, rows, numShares, batch, crc, crcBad);
+    last = (numRead != (ssize_t)batch);
+    const size_t stripes = numRead;
+    for (size_t stripe = 0; stripe < stripes; ++stripe)
+    {
+      for (const int idx : avail)
+      {
+        if (crcBad[idx][stripe])
+        {
+          std::cout << "stripe " << (done + stripe) << ", share "
+                    << std::setw(2) << std::setfill('0') << std::hex
+                    << idx << std::dec << " fails its CRC" << std::endl;
+          ret = false;
+        }
+      }
+    }
+
+    // check stripes [first, end), noting the bad ones
+    std::vector<std::vector<size_t>> bad(numThreads);
+    auto verify = [&](const unsigned thread,
+                      const size_t first, const size_t end)
+      {
+        const size_t off = first * BLOCKSIZE;
+        const size_t len = (end - first) * BLOCKSIZE;
+        std::vector<uint8_t *> run(numShares);
+        for (int idx = 0; idx < numShares; ++idx)
+        {
+          run[idx] = ((idx < numData) && gfm.failed(idx) ?
+                      calc[idx] : rows[idx]) + off;
+        }
+        gfm.recover(run.data(), rcvr, len);
+        for (const int idx : check)
+        {
+          run[idx] = calc[idx] + off;
+          gfm.parity(run.data(), len, idx);
+        }
+        for (size_t stripe = first; stripe < end; ++stripe)
+        {
+          const size_t pos = stripe * BLOCKSIZE;
+          for (const int idx : check)
+          {
+            if (memcmp(rows[idx] + pos, calc[idx] + pos, BLOCKSIZE))
+            {
+              bad[thread].push_back(stripe);
+              break;
+            }
+          }
+        }
+      };
+
+    const size_t slice = (stripes + numThreads - 1) / numThreads;
+    std::vector<Thread> workers;
+    for (unsigned thread = 0; (thread < numThreads) && (numThreads > 1); ++thread)
+    {
+      const size_t first = thread * slice;
+      if (first < stripes)
+      {
+        const size_t to = std::min(stripes, first + slice);
+        workers.emplace_back([&, thread, first, to]()
+                             { verify(thread, first, to); });
+      }
+    }
+    if (numThreads == 1)
+    {
+      verify(0, 0, stripes);
+    }
+    JoinAll(workers);
+
+    // which share is to blame?
+    for (const std::vector<size_t> & badStripes : bad)
+    {
+      for (const size_t stripe : badStripes)
+      {
+        std::vector<uint8_t *> blocks(numShares, nullptr);
+        for (const int idx : avail)
+        {
+          blocks[idx] = rows[idx] + (stripe * BLOCKSIZE);
+        }
+        std::cout << "stripe " << (done + stripe) << " is inconsistent";
+        std::vector<bool> culprits;
+        if (!gfm.locate(blocks.data(), BLOCKSIZE, culprits))
+        {
+          std::cout << ", too many bad shares to tell which";
+        }
+        for (const int idx : avail)
+        {
+          if (culprits[idx])
+          {
+            std::cout << ", share " << std::setw(2) << std::setfill('0')
+                      << std::hex << idx << std::dec << " is bad";
+          }
+        }
+        std::cout << std::endl;
+        ++numBad;
+        ret = false;
+      }
+    }
+    done += stripes;
+  }
+  std::cerr << "checked " << done << " stripes, "
+            << numBad << " inconsistent" << std::endl;
+
+  free(rows);
+  free(calc);
+  free(rcvr);
+  for (int idx = 0; idx < numShares; ++idx)
+  {
+    close(fds[idx]);
+  }
+  return ret;
+}
+
+/**
+   Recover given only the filename stub.
+*/
+void RecoverData(const std::string & stub)
+{
+  RecoverData(stub, stub, RecoveryOptions());
 }
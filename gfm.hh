@@ -1,10 +1,143 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <openssl/evp.h>
 #include <string>
+#include <sys/types.h>
+#include <vector>
 
 void CreateParity(const uint8_t numData,
                   const uint8_t numParity,
-                  const std::string & stub);
+                  const std::string & stub,
+                  const bool crc = false);
+
+/// Splits what's read from fd into the shares fds[], without closing
+/// any of them, napping after the last write to each. Returns the
+/// .sha256 manifest of the shares and the data, named after stub.
+std::string SplitShares(const uint8_t numData,
+                        const uint8_t numParity,
+                        const std::string & stub,
+                        const int fd,
+                        const int * fds,
+                        const bool crc = false,
+                        const std::chrono::milliseconds nap =
+                        std::chrono::milliseconds(0));
+
+/// Splits a stream held in memory into shares, in the same format as
+/// CreateParity(). Feed it the data with update() and finish with
+/// final(), each appending what's ready of share idx to shares[idx].
+/// An encoder can be reused once final() has been called. Encoders
+/// share nothing, so each thread can have its own.
+class ShareEncoder
+{
+public:
+  ShareEncoder(const uint8_t numData,
+               const uint8_t numParity,
+               const bool crc = false);
+  virtual ~ShareEncoder();
+
+  void update(const void * data,
+              size_t len,
+              std::vector<std::vector<uint8_t>> & shares);
+  void final(std::vector<std::vector<uint8_t>> & shares);
+
+private:
+  struct State;
+  std::unique_ptr<State> state;
+};
+
+/// Recovers a stream from shares held in memory, the reverse of
+/// ShareEncoder. Give it the bytes of each share, in order and as they
+/// come, with update(slot, ...), the slot (< 250) telling the shares
+/// apart: which share is which is read from its header. Any numData of
+/// the shares will do. Each call appends the data recovered so far to
+/// data, and final() the rest once all the shares have been given. A
+/// decoder can be reused once final() has been called.
+/// With correct, every stripe is checked against all the shares given,
+/// and corrupt blocks located and corrected, as with --correct.
+class ShareDecoder
+{
+public:
+  explicit ShareDecoder(const bool correct = false);
+  virtual ~ShareDecoder();
+
+  void update(const uint8_t slot,
+              const void * buff,
+              size_t len,
+              std::vector<uint8_t> & data);
+  void final(std::vector<uint8_t> & data);
+
+  /// would more of the share in slot help? Lets a caller with spare
+  /// shares read only those needed, calling end() for those it has
+  /// given all of
+  bool wants(const uint8_t slot) const;
+  void end(const uint8_t slot);
+
+  /// the bad blocks found in each share, by share number, as of the
+  /// last final()
+  const std::vector<size_t> & corrupt() const
+    {
+      return bad;
+    }
+
+private:
+  const bool correct;
+  std::vector<size_t> bad;
+  struct State;
+  std::unique_ptr<State> state;
+};
+
+/// Reads as much of the shares fds[] as a ShareDecoder wants, writing
+/// the data to fd, or just checking the shares if fd is negative, and
+/// adding it to ctx if given. Returns the bad blocks found in each
+/// share, by share number.
+std::vector<size_t> DecodeShares(const std::vector<int> & fds,
+                                 const int fd,
+                                 const bool correct = false,
+                                 EVP_MD_CTX * ctx = nullptr);
+
+/// how to choose the shares to recover from
+struct RecoveryOptions
+{
+  /// shares to use first, in order
+  std::vector<uint8_t> prefer;
+  /// rank the other shares by measured read speed rather than
+  /// preferring data shares
+  bool fastest = false;
+  /// first byte to recover
+  off_t offset = 0;
+  /// number of bytes to recover, -1 for all of them
+  off_t length = -1;
+  /// bytes to read from each share at a time, 0 for the default
+  size_t batch = 0;
+  /// extra shares to read, each batch being recovered from the first
+  /// of them to be read
+  int hedge = 0;
+  /// read all the shares, locating and correcting corrupt blocks
+  bool correct = false;
+  /// more directories to look for shares in, after the stub's
+  std::vector<std::string> search;
+  /// share files given by name, which may be pipes
+  std::vector<std::string> shares;
+};
+
+void ReshareData(const uint8_t numData,
+                 const uint8_t numParity,
+                 const std::string & stub);
+
+void RepairShares(const std::string & stub);
+bool VerifyShares(const std::string & stub);
+void ExtendShares(const std::string & stub, const uint8_t numNew);
+
+/// all the built-in tests, the slower ones aren't run on start up
+void SelfTest();
+
+std::string MakeFilename(const std::string & stub, const int num);
+std::string StripDir(const std::string & filename);
 
 void RecoverData(const std::string & stub);
+void RecoverData(const std::string & stub,
+                 const std::string & output,
+                 const RecoveryOptions & options = RecoveryOptions());
@@ -0,0 +1,36 @@
+#include "libslss.hh"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+bool ends_with(std::string const & str,
+               std::string const & end)
+{
+  return ((end.size() <= str.size())
+          &&
+          std::equal(end.rbegin(), end.rend(), str.rbegin()));
+}
+
+void attest(bool test, const char * epilogue, ...)
+{
+  if (test)
+  {
+    return;
+  }
+  // %m needs errno as it was
+  const int err = errno;
+  va_list ap;
+  va_start(ap, epilogue);
+  va_list aq;
+  va_copy(aq, ap);
+  const int len = vsnprintf(nullptr, 0, epilogue, ap);
+  va_end(ap);
+  std::vector<char> msg(std::max(len, 0) + 1);
+  errno = err;
+  vsnprintf(msg.data(), msg.size(), epilogue, aq);
+  va_end(aq);
+  throw SlssError(msg.data());
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+/// libslss: splitting (gfm.hh) and encryption (aont.hh) for use in
+/// other programs. Errors are reported by throwing SlssError rather
+/// than exiting.
+
+#include "slss.hh"
+
+#include "aont.hh"
+#include "gfm.hh"
@@ -31,6 +31,7 @@ make
 ./aont 1 2 || true
 ./gfm  1 2 || true
 ./slss 1 2 || true
+./gfm --self-test
 
 DIR=$( mktemp --directory )
 # Plainetxt
@@ -64,6 +65,21 @@ md5sum --check ${DIR}/md5sum < ${DIR}/banana0
 md5sum --check ${DIR}/md5sum < ${DIR}/banana1
 md5sum --check ${DIR}/md5sum < ${DIR}/banana2
 md5sum --check ${DIR}/md5sum < ${DIR}/plaintext
+# decrypt to STDOUT
+./aont "${DIR}/banana0.aont" - | md5sum --check ${DIR}/md5sum
+# non-default cipher and digest, recorded in the package
+./aont --cipher=chacha20 --digest=sha512-256 "${DIR}/banana3" < "${DIR}/plaintext"
+./aont "${DIR}/banana3.aont" - | md5sum --check ${DIR}/md5sum
+./aont --cipher=aes-128-ctr --digest=blake2b512 - < "${DIR}/plaintext" > "${DIR}/banana4.aont"
+./aont "${DIR}/banana4.aont" - | md5sum --check ${DIR}/md5sum
+# segmented, decrypted in one pass from a pipe
+./aont --segment=64K - < "${DIR}/plaintext" > "${DIR}/banana5.aont"
+./aont --decrypt < "${DIR}/banana5.aont" | md5sum --check ${DIR}/md5sum
+./aont "${DIR}/banana5.aont" - | md5sum --check ${DIR}/md5sum
+# compressed, single and segmented
+./aont --compress "${DIR}/banana6" < "${DIR}/plaintext"
+./aont "${DIR}/banana6.aont" - | md5sum --check ${DIR}/md5sum
+./aont --compress=9 --segment=64K - < "${DIR}/plaintext" | ./aont --decrypt | md5sum --check ${DIR}/md5sum
 
 #                 m""
 #         mmmm  mm#mm  mmmmm
@@ -75,12 +91,131 @@ md5sum --check ${DIR}/md5sum < ${DIR}/plaintext
 
 # encode
 ./gfm "${DIR}/plaintext" 3 2
+# recover from the data shares alone
+./gfm --prefer=00,01 "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
 # remove a file
 rm "${DIR}/plaintext_01.tar"
 # recover
 ./gfm "${DIR}/plaintext"
 # check
 md5sum --check ${DIR}/md5sum < ${DIR}/plaintext
+# recover to STDOUT
+./gfm "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+# recover from chosen shares
+./gfm --prefer=02 "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+./gfm --prefer=fastest "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+# recover in small batches
+./gfm --batch=2K "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+./gfm --batch=3K --range=5000:9000 "${DIR}/plaintext" - | cmp - <(tail --bytes=+5001 "${DIR}/plaintext" | head --bytes=9000)
+# recover from whichever shares read first
+./gfm --hedge --batch=2K "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+# recover with a share in another directory
+mkdir "${DIR}/elsewhere"
+mv "${DIR}/plaintext_02.tar" "${DIR}/elsewhere/"
+./gfm --search="${DIR}/elsewhere" --prefer=02 "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+mv "${DIR}/elsewhere/plaintext_02.tar" "${DIR}/"
+# recover from pipes
+./gfm --shares=<(cat "${DIR}/plaintext_02.tar"),<(cat "${DIR}/plaintext_00.tar") --prefer=02,00 "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+# recover part of it
+./gfm --range=10:20 "${DIR}/plaintext" - | cmp - <(tail --bytes=+11 "${DIR}/plaintext" | head --bytes=20)
+./gfm --range=10    "${DIR}/plaintext" - | cmp - <(tail --bytes=+11 "${DIR}/plaintext")
+# rebuild the missing share
+./gfm --repair "${DIR}/plaintext"
+( cd "${DIR}" && sha256sum --check plaintext.sha256 )
+# add two shares, recover from the new ones
+./gfm --extend=2 "${DIR}/plaintext"
+( cd "${DIR}" && sha256sum --check plaintext.sha256 )
+./gfm --prefer=03,04 "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+# check the shares, damage one and check again
+./gfm --verify "${DIR}/plaintext"
+printf '\xff' | dd of="${DIR}/plaintext_04.tar" bs=1 seek=$(( $(stat --format=%s "${DIR}/plaintext_04.tar") - 100 )) conv=notrunc
+if ./gfm --verify "${DIR}/plaintext" ; then exit 1 ; fi
+# recovering from it reports the manifest mismatch
+./gfm --prefer=04 "${DIR}/plaintext" - 2>&1 > /dev/null | grep "share 04 doesn't match"
+# the spare shares locate it, and recovery corrects it
+./gfm --verify "${DIR}/plaintext" | grep "share 04 is bad"
+./gfm --correct "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+./gfm --correct "${DIR}/plaintext" - 2>&1 > /dev/null | grep "share 04 is corrupt"
+rm "${DIR}/plaintext_04.tar"
+./gfm --repair "${DIR}/plaintext"
+./gfm --verify "${DIR}/plaintext"
+# a share cut short is replaced by a spare
+truncate --size=-1 "${DIR}/plaintext_02.tar"
+./gfm --prefer=02 "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+# split with block CRCs, damage two shares and recover through it
+./gfm --crc "${DIR}/plaintext" 4 2
+printf '\xff' | dd of="${DIR}/plaintext_00.tar" bs=1 seek=$(( $(stat --format=%s "${DIR}/plaintext_00.tar") - 100 )) conv=notrunc
+printf '\xff' | dd of="${DIR}/plaintext_01.tar" bs=1 seek=$(( $(stat --format=%s "${DIR}/plaintext_01.tar") - 100 )) conv=notrunc
+./gfm "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+if ./gfm --verify "${DIR}/plaintext" ; then exit 1 ; fi
+
+# the library: split in memory, to the same shares as gfm, and recover
+# from the last three shares fed in turn
+g++ -std=c++17 -pthread -x c++ - -x none libslss.a $( pkg-config --libs openssl zlib ) -o "${DIR}/libtest" <<'EOF'
+#include "libslss.hh"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+int main(int, char ** argv)
+{
+  const std::string data(std::istreambuf_iterator<char>(std::cin), {});
+  ShareEncoder encoder(3, 2);
+  std::vector<std::vector<uint8_t>> shares;
+  for (size_t pos = 0; pos < data.size(); pos += 1000)
+  {
+    encoder.update(&data[pos], std::min((size_t)1000, data.size() - pos),
+                   shares);
+  }
+  encoder.final(shares);
+  for (int idx = 0; idx < 5; ++idx)
+  {
+    std::ofstream(argv[1] + std::string("_0") + std::to_string(idx) + ".tar")
+      .write((const char *)shares[idx].data(), shares[idx].size());
+  }
+
+  ShareDecoder decoder;
+  std::vector<uint8_t> out;
+  for (size_t pos = 0; pos < shares[2].size(); pos += 333)
+  {
+    for (int idx = 2; idx < 5; ++idx)
+    {
+      decoder.update(idx, &shares[idx][pos],
+                     std::min((size_t)333, shares[idx].size() - pos), out);
+    }
+  }
+  decoder.final(out);
+  std::cout.write((const char *)out.data(), out.size());
+
+  // errors are thrown
+  try
+  {
+    decoder.final(out);
+    return 1;
+  }
+  catch (const SlssError &)
+  {
+  }
+}
+EOF
+seq 1 20000 > "${DIR}/numbers"
+"${DIR}/libtest" "${DIR}/libnumbers" < "${DIR}/numbers" | cmp - "${DIR}/numbers"
+./gfm "${DIR}/numbers" 5 3
+for IDX in 0 1 2 3 4 ; do cmp "${DIR}/numbers_0${IDX}.tar" "${DIR}/libnumbers_0${IDX}.tar" ; done
+
+# the server: the same shares as gfm, recovering and checking them again
+./gfm serve "${DIR}/socket" &
+SERVER=$!
+while [ ! -S "${DIR}/socket" ] ; do sleep 0.1 ; done
+cp "${DIR}/numbers" "${DIR}/served"
+./gfm --server="${DIR}/socket" "${DIR}/served" 5 3
+sed 's/served/numbers/' < "${DIR}/served.sha256" | cmp - "${DIR}/numbers.sha256"
+for IDX in 0 1 2 3 4 ; do cmp "${DIR}/numbers_0${IDX}.tar" "${DIR}/served_0${IDX}.tar" ; done
+rm "${DIR}/served_01.tar"
+./gfm --server="${DIR}/socket" --priority=1 "${DIR}/served" - | cmp - "${DIR}/numbers"
+./gfm --server="${DIR}/socket" --verify "${DIR}/served"
+kill "${SERVER}"
 
 # retrieve tarball
 pushd  ${DIR}/
@@ -109,6 +244,8 @@ md5sum --check ${DIR}/md5sum < ${DIR}/plaintext
 ./slss "${DIR}/plaintext.aont"
 # verify
 md5sum --check ${DIR}/md5sum < ${DIR}/plaintext
+# recover and decrypt to STDOUT
+./slss "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
 
 #                               m                                  m""
 #         mmm    mmm   m mm   mm#mm           m            mmmm  mm#mm  mmmmm
@@ -127,4 +264,15 @@ rm     "${DIR}/plaintext.aont_01.tar"
 ./gfm  "${DIR}/plaintext.aont"
 ./aont "${DIR}/plaintext.aont"
 
+./slss --cipher=chacha20 --digest=blake2b512 "${DIR}/plaintext" 3 2
+rm     "${DIR}/plaintext.aont_00.tar"
+./slss "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+
+./slss --segment=64K --compress "${DIR}/plaintext" 4 2
+rm     "${DIR}/plaintext.aont_01.tar" "${DIR}/plaintext.aont_02.tar"
+./slss "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+./slss --reshare "${DIR}/plaintext" 5 3
+rm     "${DIR}/plaintext.aont_00.tar" "${DIR}/plaintext.aont_03.tar"
+./slss "${DIR}/plaintext" - | md5sum --check ${DIR}/md5sum
+
 ls -alFrt "${DIR}"
@@ -0,0 +1,584 @@
+#include "slss.hh"
+#include "gfm.hh"
+#include "serve.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <queue>
+#include <signal.h>
+#include <sstream>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+// the most descriptors a message can carry (SCM_MAX_FD)
+static const size_t MAX_FDS = 253;
+// the longest request
+static const size_t MAX_REQUEST = 4096;
+
+/// a request, and the connection to reply on
+struct Job
+{
+  // higher first ...
+  int priority = 0;
+  // ... then first come, first served
+  uint64_t seq = 0;
+  int conn = -1;
+  // the request's first line, less priority=N
+  std::vector<std::string> words;
+  // and the second
+  std::string stub;
+  std::vector<int> fds;
+
+  bool operator<(const Job & other) const
+    {
+      return (priority != other.priority) ? (priority < other.priority) :
+        (seq > other.seq);
+    }
+};
+
+/// jobs waiting for a worker
+class JobQueue
+{
+public:
+  void push(Job && job)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.seq = seq++;
+        jobs.push(std::move(job));
+      }
+      ready.notify_one();
+    }
+
+  Job pop()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [&]{ return !jobs.empty(); });
+      Job job = jobs.top();
+      jobs.pop();
+      return job;
+    }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::priority_queue<Job> jobs;
+  uint64_t seq = 0;
+};
+
+static sockaddr_un Address(const std::string & path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  attest(path.size() < sizeof(addr.sun_path),
+         "socket path too long: \"%s\"", path.c_str());
+  strcpy(addr.sun_path, path.c_str());
+  return addr;
+}
+
+// send it all, or as much as the client will take
+static void Send(const int conn, const std::string & text)
+{
+  size_t done = 0;
+  while (done < text.size())
+  {
+    const ssize_t rc = send(conn, text.data() + done, text.size() - done,
+                            MSG_NOSIGNAL);
+    if (rc <= 0)
+    {
+      return;
+    }
+    done += rc;
+  }
+}
+
+// read a request and its descriptors from conn, false if it's not
+// there yet
+static bool Receive(const int conn, Job & job)
+{
+  job.conn = conn;
+  char text[MAX_REQUEST];
+  iovec iov = { text, sizeof(text) };
+  union
+  {
+    char    buff[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    cmsghdr align;
+  } control;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buff;
+  msg.msg_controllen = sizeof(control.buff);
+
+  const ssize_t len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return false;
+  }
+  for (cmsghdr * cmsg = (len > 0) ? CMSG_FIRSTHDR(&msg) : nullptr;
+       cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+    {
+      const size_t num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int * fds = (const int *)CMSG_DATA(cmsg);
+      job.fds.insert(job.fds.end(), fds, fds + num);
+    }
+  }
+  attest(len > 0, "Unable to read request: %m");
+  attest(!(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)), "request too long");
+
+  const std::string request(text, len);
+  const size_t eol = request.find('\n');
+  std::istringstream line(request.substr(0, eol));
+  if (eol != std::string::npos)
+  {
+    job.stub = request.substr(eol + 1);
+    while (!job.stub.empty() && (job.stub.back() == '\n'))
+    {
+      job.stub.pop_back();
+    }
+  }
+  std::string word;
+  while (line >> word)
+  {
+    if (word.compare(0, 9, "priority=") == 0)
+    {
+      job.priority = std::stoi(word.substr(9));
+      continue;
+    }
+    job.words.push_back(word);
+  }
+  attest(!job.words.empty(), "empty request");
+  return true;
+}
+
+// "share XX: N bad blocks" for each share with any
+static std::string Report(const std::vector<size_t> & bad)
+{
+  std::ostringstream o;
+  for (size_t idx = 0; idx < bad.size(); ++idx)
+  {
+    if (bad[idx])
+    {
+      o << "share " << std::setw(2) << std::setfill('0') << std::hex
+        << idx << std::dec << ": " << bad[idx] << " bad blocks\n";
+    }
+  }
+  return o.str();
+}
+
+// the digest so far, in hex
+static std::string Hex(EVP_MD_CTX * ctx)
+{
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int  len = sizeof(md);
+  EVP_DigestFinal_ex(ctx, md, &len);
+  std::ostringstream o;
+  for (unsigned idx = 0; idx < len; ++idx)
+  {
+    o << std::setw(2) << std::setfill('0') << std::hex << (md[idx] & 0xFF);
+  }
+  return o.str();
+}
+
+// do the job, adding its output to reply
+static void Run(const Job & job, std::string & reply)
+{
+  const std::string & what(job.words[0]);
+  bool crc     = false;
+  bool correct = false;
+  // what the recovered data's sha256 should be, if known
+  std::string digest;
+  std::vector<int> nums;
+  for (size_t idx = 1; idx < job.words.size(); ++idx)
+  {
+    const std::string & word(job.words[idx]);
+    if (word == "crc")
+    {
+      crc = true;
+    }
+    else if (word == "correct")
+    {
+      correct = true;
+    }
+    else if (word.compare(0, 7, "sha256=") == 0)
+    {
+      digest = word.substr(7);
+    }
+    else
+    {
+      nums.push_back(std::stoi(word));
+    }
+  }
+
+  if (what == "split")
+  {
+    attest(nums.size() == 2, "split needs NUM_DATA and NUM_PARITY");
+    attest((nums[0] >= 2) && (nums[1] >= 1) && (nums[0] + nums[1] <= 240),
+           "can't split into %d data and %d parity shares",
+           nums[0], nums[1]);
+    attest(job.fds.size() == (size_t)(1 + nums[0] + nums[1]),
+           "split needs %d files, got %zu", 1 + nums[0] + nums[1],
+           job.fds.size());
+    attest(!job.stub.empty(), "split needs a STUB");
+    reply += SplitShares(nums[0], nums[1], job.stub,
+                         job.fds[0], &job.fds[1], crc);
+    return;
+  }
+  attest(nums.empty(), "unexpected argument for %s", what.c_str());
+  if (what == "recover")
+  {
+    attest(job.fds.size() >= 2, "recover needs an output and shares");
+    const std::vector<int> shares(job.fds.begin() + 1, job.fds.end());
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>
+      ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    attest(ctx && EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr),
+           "Unable to create payload context");
+    reply += Report(DecodeShares(shares, job.fds[0], correct, ctx.get()));
+    attest(digest.empty() || (Hex(ctx.get()) == digest),
+           "recovered data doesn't match the manifest");
+    return;
+  }
+  if (what == "verify")
+  {
+    const std::string report(Report(DecodeShares(job.fds, -1, true)));
+    reply += report;
+    attest(report.empty(), "shares are inconsistent");
+    return;
+  }
+  attest(false, "unknown job \"%s\"", what.c_str());
+}
+
+static void Work(JobQueue & queue)
+{
+  while (true)
+  {
+    const Job job = queue.pop();
+    std::string reply;
+    try
+    {
+      Run(job, reply);
+      reply += "ok\n";
+    }
+    catch (const std::exception & e)
+    {
+      reply += std::string("error: ") + e.what() + "\n";
+    }
+    for (const int fd : job.fds)
+    {
+      close(fd);
+    }
+    Send(job.conn, reply);
+    close(job.conn);
+
+    std::ostringstream o;
+    o << "job " << job.seq << " (" << job.words[0] << ", priority "
+      << job.priority << "): "
+      << reply.substr(reply.rfind('\n', reply.size() - 2) + 1);
+    std::cerr << o.str() << std::flush;
+  }
+}
+
+void Serve(const std::string & path)
+{
+  // clients that go away are their problem
+  signal(SIGPIPE, SIG_IGN);
+
+  const sockaddr_un addr = Address(path);
+  const int sock = socket(AF_UNIX,
+                          SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  attest(sock >= 0, "socket: %m");
+  // replace a stale socket, but nothing else
+  struct stat st;
+  if ((lstat(path.c_str(), &st) == 0) && S_ISSOCK(st.st_mode))
+  {
+    unlink(path.c_str());
+  }
+  attest(!bind(sock, (const sockaddr *)&addr, sizeof(addr)),
+         "bind(%s): %m", path.c_str());
+  attest(!listen(sock, SOMAXCONN), "listen(%s): %m", path.c_str());
+
+  JobQueue queue;
+  const unsigned numWorkers = std::max(1U, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
+  for (unsigned idx = 0; idx < numWorkers; ++idx)
+  {
+    workers.emplace_back(Work, std::ref(queue));
+  }
+  std::cerr << "serving on " << path << " with " << numWorkers
+            << " workers" << std::endl;
+
+  // connections whose request hasn't arrived yet, and when to give up
+  // on them. Waiting for them all at once, none holds up the others
+  typedef std::chrono::steady_clock clock;
+  std::map<int, clock::time_point> waiting;
+  while (true)
+  {
+    std::vector<pollfd> polls(1, pollfd{sock, POLLIN, 0});
+    clock::time_point next = clock::time_point::max();
+    for (const auto & conn : waiting)
+    {
+      polls.push_back(pollfd{conn.first, POLLIN, 0});
+      next = std::min(next, conn.second);
+    }
+    const int timeout = waiting.empty() ? -1 :
+      std::max((int64_t)0, (int64_t)std::chrono::duration_cast<
+                 std::chrono::milliseconds>(next - clock::now()).count() + 1);
+    attest((poll(polls.data(), polls.size(), timeout) >= 0) ||
+           (errno == EINTR), "poll(%s): %m", path.c_str());
+
+    const clock::time_point now = clock::now();
+    for (size_t idx = 1; idx < polls.size(); ++idx)
+    {
+      const int conn = polls[idx].fd;
+      const bool late = (now >= waiting[conn]);
+      if (!polls[idx].revents && !late)
+      {
+        continue;
+      }
+      Job job;
+      try
+      {
+        if (!Receive(conn, job))
+        {
+          attest(!late, "timed out waiting for the request");
+          continue;
+        }
+        queue.push(std::move(job));
+      }
+      catch (const std::exception & e)
+      {
+        Send(conn, std::string("error: ") + e.what() + "\n");
+        for (const int fd : job.fds)
+        {
+          close(fd);
+        }
+        close(conn);
+      }
+      waiting.erase(conn);
+    }
+
+    if (polls[0].revents)
+    {
+      const int conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+      if (conn < 0)
+      {
+        attest((errno == EINTR) || (errno == EAGAIN) ||
+               (errno == ECONNABORTED) ||
+               (errno == EMFILE) || (errno == ENFILE),
+               "accept(%s): %m", path.c_str());
+        continue;
+      }
+      waiting[conn] = now + std::chrono::seconds(5);
+    }
+  }
+}
+
+bool SubmitJob(const std::string & path,
+               const std::string & request,
+               const std::vector<int> & fds,
+               std::string & reply)
+{
+  attest(fds.size() <= MAX_FDS, "too many files: %zu", fds.size());
+  attest(request.size() <= MAX_REQUEST, "request too long");
+  const sockaddr_un addr = Address(path);
+  const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  attest(sock >= 0, "socket: %m");
+  attest(!connect(sock, (const sockaddr *)&addr, sizeof(addr)),
+         "Unable to connect to \"%s\": %m", path.c_str());
+
+  iovec iov = { (void *)request.data(), request.size() };
+  std::vector<char> control(CMSG_SPACE(fds.size() * sizeof(int)));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov    = &iov;
+  msg.msg_iovlen = 1;
+  if (!fds.empty())
+  {
+    msg.msg_control    = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(fds.size() * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+  }
+  attest(sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)request.size(),
+         "Unable to send job to \"%s\": %m", path.c_str());
+
+  // the reply ends when the server hangs up
+  reply.clear();
+  char buff[4096];
+  ssize_t rc;
+  while ((rc = read(sock, buff, sizeof(buff))) > 0)
+  {
+    reply.append(buff, rc);
+  }
+  attest(rc == 0, "Unable to read reply from \"%s\": %m", path.c_str());
+  close(sock);
+
+  const std::string ok("ok\n");
+  if ((reply.size() >= ok.size()) &&
+      (reply.compare(reply.size() - ok.size(), ok.size(), ok) == 0) &&
+      ((reply.size() == ok.size()) ||
+       (reply[reply.size() - ok.size() - 1] == '\n')))
+  {
+    reply.resize(reply.size() - ok.size());
+    return true;
+  }
+  return false;
+}
+
+// the request's priority option
+static std::string Priority(const int priority)
+{
+  return " priority=" + std::to_string(priority);
+}
+
+// the digest of stub in its manifest, if it has one
+static std::string Digest(const std::string & stub)
+{
+  std::ifstream manifest(stub + ".sha256");
+  const std::string name("  " + StripDir(stub));
+  std::string line;
+  while (std::getline(manifest, line))
+  {
+    if ((line.size() > name.size()) &&
+        (line.compare(line.size() - name.size(), name.size(), name) == 0))
+    {
+      return line.substr(0, line.size() - name.size());
+    }
+  }
+  return "";
+}
+
+// the shares of stub that can be opened
+static std::vector<int> OpenShares(const std::string & stub)
+{
+  std::vector<int> fds;
+  for (int idx = 0; idx < 250; ++idx)
+  {
+    const int fd = open(MakeFilename(stub, idx).c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+      fds.push_back(fd);
+    }
+  }
+  attest(!fds.empty(), "Unable to find any shares of \"%s\"", stub.c_str());
+  return fds;
+}
+
+bool SplitRemote(const std::string & path,
+                 const uint8_t numData,
+                 const uint8_t numParity,
+                 const std::string & stub,
+                 const bool crc,
+                 const int priority)
+{
+  std::vector<int> fds(1, open(stub.c_str(), O_RDONLY));
+  attest(fds[0] != -1, "Unable to open \"%s\": %m", stub.c_str());
+  for (int idx = 0; idx < (numData + numParity); ++idx)
+  {
+    const std::string filename = MakeFilename(stub, idx);
+    fds.push_back(open(filename.c_str(),
+                       O_WRONLY | O_CREAT | O_TRUNC,
+                       S_IRUSR | S_IWUSR));
+    attest(fds.back() != -1, "Unable to open file: '%s'", filename.c_str());
+  }
+  std::string reply;
+  const bool ok = SubmitJob(path,
+                            "split " + std::to_string(numData) + " " +
+                            std::to_string(numParity) + (crc ? " crc" : "") +
+                            Priority(priority) + "\n" + StripDir(stub),
+                            fds, reply);
+  for (const int fd : fds)
+  {
+    close(fd);
+  }
+  if (!ok)
+  {
+    std::cerr << reply;
+    return false;
+  }
+  std::ofstream manifest(stub + ".sha256");
+  manifest << reply;
+  attest(manifest.good(), "Unable to write \"%s.sha256\"", stub.c_str());
+  return true;
+}
+
+bool RecoverRemote(const std::string & path,
+                   const std::string & stub,
+                   const std::string & output,
+                   const bool correct,
+                   const int priority)
+{
+  std::vector<int> fds = OpenShares(stub);
+  const int fd = (output == "-") ? STDOUT_FILENO :
+    open(output.c_str(),
+         O_WRONLY | O_CREAT | O_TRUNC,
+         S_IRUSR | S_IWUSR);
+  attest(fd != -1, "open(%s,WRONLY): %m", output.c_str());
+  fds.insert(fds.begin(), fd);
+  std::string reply;
+  bool ok = false;
+  try
+  {
+    const std::string digest = Digest(stub);
+    ok = SubmitJob(path,
+                   std::string("recover") +
+                   (correct ? " correct" : "") +
+                   (digest.empty() ? "" : " sha256=" + digest) +
+                   Priority(priority) + "\n",
+                   fds, reply);
+  }
+  catch (...)
+  {
+    // the output may be a pipe, whose reader waits for it to close
+    for (const int share : fds)
+    {
+      close(share);
+    }
+    throw;
+  }
+  for (const int share : fds)
+  {
+    close(share);
+  }
+  std::cerr << reply;
+  return ok;
+}
+
+bool VerifyRemote(const std::string & path,
+                  const std::string & stub,
+                  const int priority)
+{
+  const std::vector<int> fds = OpenShares(stub);
+  std::string reply;
+  const bool ok = SubmitJob(path, "verify" + Priority(priority) + "\n",
+                            fds, reply);
+  for (const int fd : fds)
+  {
+    close(fd);
+  }
+  std::cout << reply;
+  return ok;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Serves jobs on a Unix socket at path, never returning. Each
+/// connection sends one request, with the files it needs passed as
+/// descriptors (SCM_RIGHTS) in the same message:
+///
+///   split NUM_DATA NUM_PARITY [crc] [priority=N]\nSTUB
+///       input, then a share for each of NUM_DATA + NUM_PARITY
+///   recover [correct] [sha256=DIGEST] [priority=N]
+///       output, then the shares to recover from
+///   verify [priority=N]
+///       the shares to check
+///
+/// and is sent back lines of output (the manifest for split, the bad
+/// blocks in each share otherwise) then "ok" or "error: WHY". Jobs are
+/// run by a pool of worker threads, highest priority first, sharing
+/// cached recovery matrices and each reusing its buffers.
+void Serve(const std::string & path) __attribute__((noreturn));
+
+/// Sends request and fds to the server at path, returning its reply,
+/// all but the last line in reply, and whether it succeeded.
+bool SubmitJob(const std::string & path,
+               const std::string & request,
+               const std::vector<int> & fds,
+               std::string & reply);
+
+/// gfm STUB NUM_SHARES NUM_REQUIRED, by the server at path
+bool SplitRemote(const std::string & path,
+                 const uint8_t numData,
+                 const uint8_t numParity,
+                 const std::string & stub,
+                 const bool crc,
+                 const int priority);
+
+/// gfm STUB OUTPUT, by the server at path, from the shares next to STUB
+bool RecoverRemote(const std::string & path,
+                   const std::string & stub,
+                   const std::string & output,
+                   const bool correct,
+                   const int priority);
+
+/// gfm --verify STUB, by the server at path
+bool VerifyRemote(const std::string & path,
+                  const std::string & stub,
+                  const int priority);
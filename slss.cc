@@ -2,12 +2,18 @@
 
 #include "aont.hh"
 #include "gfm.hh"
+#include "serve.hh"
 
 #include <cstdio>
+#include <exception>
+#include <fcntl.h>
 #include <iostream>
 #include <libgen.h>
-#include <stdarg.h>
+#include <map>
+#include <signal.h>
+#include <sstream>
 #include <stdlib.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -18,14 +24,9 @@ static void rtfm_gfm(const std::string & prog, const bool copying = false)
 static void rtfm_slss(const std::string & prog, const bool copying = false)
   __attribute__((noreturn));
 
+/// command line options, "--NAME=VALUE" (or "--NAME")
+typedef std::map<std::string, std::string> Options;
 
-bool ends_with(std::string const & str,
-               std::string const & end)
-{
-  return ((end.size() <= str.size())
-          &&
-          std::equal(end.rbegin(), end.rend(), str.rbegin()));
-}
 
 static void rtfm(const std::string & prog, const bool copying = false)
 {
@@ -57,6 +58,78 @@ static void rtfm(const std::string & prog, const bool copying = false)
 }
 
 
+static void rtfm_options()
+{
+  std::cerr <<
+    "\t--cipher=NAME  all-or-nothing cipher, e.g. chacha20 (aes-256-cbc)\n"
+    "\t--digest=NAME  all-or-nothing digest, e.g. sha512-256 or blake2b512\n"
+    "\t               (sha384)\n"
+    "\t--segment[=SIZE]\n"
+    "\t               encrypt in independent segments of SIZE (16M)\n"
+    "\t               bytes, a power of 2 with optional K, M or G suffix.\n"
+    "\t               Segmented files decrypt in a single pass from a\n"
+    "\t               pipe, buffering one segment\n"
+    "\t--compress[=LEVEL]\n"
+    "\t               zlib compress (level 1-9, 6) before encrypting\n"
+    "\t               non-default choices are recorded in the encrypted\n"
+    "\t               file, they are not needed to decrypt\n"
+            << std::endl;
+}
+
+static void rtfm_recovery_options()
+{
+  std::cerr <<
+    "\t--prefer=LIST  recover from the shares in LIST (comma separated\n"
+    "\t               share numbers, as in the share filenames) first,\n"
+    "\t               then data shares before parity shares. \"fastest\"\n"
+    "\t               in LIST ranks the others by measured read speed\n"
+    "\t--search=DIRS  also look for shares in DIRS (colon separated),\n"
+    "\t               after the directory of STUB\n"
+    "\t--shares=FILES use the shares in FILES (comma separated), which\n"
+    "\t               may be pipes, e.g. \"/dev/fd/N\", as well\n"
+    "\t--batch=SIZE   read SIZE bytes (optional K, M or G suffix) from\n"
+    "\t               each share at a time\n"
+    "\t--hedge[=NUM]  read NUM (1) more shares than needed, recovering\n"
+    "\t               each batch from the first to arrive\n"
+    "\t--correct      read all the shares, using those beyond the ones\n"
+    "\t               needed to locate and correct corrupt blocks\n"
+            << std::endl;
+}
+
+static void rtfm_split_options()
+{
+  std::cerr <<
+    "\t--crc          add a CRC32C to every block of the shares when\n"
+    "\t               splitting, so damaged blocks are detected and\n"
+    "\t               recovered from the other shares\n"
+            << std::endl;
+}
+
+static void rtfm_server(const std::string & prog)
+{
+  std::cerr <<
+    prog << " serve SOCKET\n"
+    "\t\trun split, recover and verify jobs sent to the Unix\n"
+    "\t\tsocket SOCKET, on a shared pool of worker threads\n"
+            << std::endl;
+  std::cerr <<
+    "\t--server=SOCKET\n"
+    "\t               split, recover or verify by the server at SOCKET,\n"
+    "\t               passing it the files. Only --crc and --correct\n"
+    "\t               apply, slss still encrypts and decrypts itself\n"
+    "\t--priority=NUM run before the server's jobs of lower (0) priority\n"
+            << std::endl;
+}
+
+static void rtfm_range()
+{
+  std::cerr <<
+    "\t--range=OFFSET[:LENGTH]\n"
+    "\t               recover only LENGTH (or the rest) of the bytes\n"
+    "\t               from OFFSET, with optional K, M or G suffixes\n"
+            << std::endl;
+}
+
 static void rtfm_aont(const std::string & prog, const bool copying)
 {
   rtfm(prog, copying);
@@ -72,6 +145,16 @@ static void rtfm_aont(const std::string & prog, const bool copying)
     "\t" << prog << " STUB.aont\n"
     "\t\tdecrypt STUB.aont to STUB\n"
             << std::endl;
+  std::cerr <<
+    "\t" << prog << " STUB.aont OUTPUT\n"
+    "\t\tdecrypt STUB.aont to OUTPUT (\"-\" for STDOUT)\n"
+            << std::endl;
+  std::cerr <<
+    "\t" << prog << " --decrypt [INPUT [OUTPUT]]\n"
+    "\t\tdecrypt INPUT (\"-\" or default: STDIN, segmented only)\n"
+    "\t\tto OUTPUT (\"-\" or default: STDOUT)\n"
+            << std::endl;
+  rtfm_options();
   exit(1);
 }
 
@@ -79,11 +162,37 @@ static void rtfm_gfm(const std::string & prog, const bool copying)
 {
   rtfm(prog, copying);
   std::cerr <<
-    prog << " STUB [NUM_SHARES NUM_REQUIRED]\n"
+    prog << " STUB [NUM_SHARES NUM_REQUIRED | OUTPUT]\n"
     "\tSTUB           filename stub for files to split or recover\n"
     "\tNUM_SHARES     number of shares to create\n"
     "\tNUM_REQUIRED   number of shares required to recover\n"
+    "\tOUTPUT         recover to OUTPUT (\"-\" for STDOUT) instead of STUB\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --repair STUB\n"
+    "\t\trebuild missing shares from the others\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --verify STUB\n"
+    "\t\tcheck the shares are consistent, naming any bad ones\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --extend[=NUM] STUB\n"
+    "\t\tadd NUM (1) shares, leaving the existing ones as they are\n"
             << std::endl;
+  std::cerr <<
+    prog << " --reshare STUB NUM_SHARES NUM_REQUIRED\n"
+    "\t\treplace the shares with NUM_SHARES new ones of which\n"
+    "\t\tNUM_REQUIRED are required, without recovering to disk\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --self-test\n"
+    "\t\trun all the built-in tests\n"
+            << std::endl;
+  rtfm_split_options();
+  rtfm_recovery_options();
+  rtfm_range();
+  rtfm_server(prog);
   exit(1);
 }
 
@@ -91,37 +200,86 @@ static void rtfm_slss(const std::string & prog, const bool copying)
 {
   rtfm(prog, copying);
   std::cerr <<
-    prog << " STUB [NUM_SHARES NUM_REQUIRED]\n"
+    prog << " STUB [NUM_SHARES NUM_REQUIRED | OUTPUT]\n"
     "\tSTUB           filename stub for files to encrypt and split\n"
     "\t               or recover and decrypt\n"
     "\tNUM_SHARES     number of shares to create\n"
     "\tNUM_REQUIRED   number of shares required to recover\n"
+    "\tOUTPUT         decrypt to OUTPUT (\"-\" for STDOUT) instead of STUB\n"
             << std::endl;
+  std::cerr <<
+    prog << " --repair STUB\n"
+    "\t\trebuild missing shares from the others\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --verify STUB\n"
+    "\t\tcheck the shares are consistent, naming any bad ones\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --extend[=NUM] STUB\n"
+    "\t\tadd NUM (1) shares, leaving the existing ones as they are\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --reshare STUB NUM_SHARES NUM_REQUIRED\n"
+    "\t\treplace the shares with NUM_SHARES new ones of which\n"
+    "\t\tNUM_REQUIRED are required, without recovering to disk\n"
+            << std::endl;
+  std::cerr <<
+    prog << " --self-test\n"
+    "\t\trun all the built-in tests\n"
+            << std::endl;
+  rtfm_options();
+  rtfm_split_options();
+  rtfm_recovery_options();
+  rtfm_server(prog);
   exit(1);
 }
 
-void attest(bool test, const char * epilogue, ...)
+// attest() throws, report it and exit, even from another thread
+static void Terminate()
 {
-  if (test)
+  try
+  {
+    if (std::current_exception())
+    {
+      throw;
+    }
+  }
+  catch (const std::exception & e)
+  {
+    fprintf(stderr, "\n%s\n", e.what());
+  }
+  catch (...)
   {
-    return;
   }
-  va_list ap;
-  va_start(ap, epilogue);
-  fprintf(stderr, "\n");
-  vfprintf(stderr, epilogue, ap);
-  fprintf(stderr, "\n");
-  va_end(ap);
   exit(1);
 }
 
+/**
+ * @brief parse a whole decimal number, what it is names it in errors
+ */
+static int ParseInt(const std::string & str, const char * what)
+{
+  size_t pos = 0;
+  int ret = 0;
+  try
+  {
+    ret = std::stoi(str, &pos);
+  }
+  catch (const std::exception &)
+  {
+  }
+  attest(pos && (pos == str.size()), "invalid %s \"%s\"", what, str.c_str());
+  return ret;
+}
+
 static void ParseNUMs(const std::vector<std::string> & args,
                       int & numShares,
                       int & numRequired)
 {
   attest(args.size() == 3, "expecting 3 arguments");
-  numShares   = std::stoi(args[1]);
-  numRequired = std::stoi(args[2]);
+  numShares   = ParseInt(args[1], "number of shares");
+  numRequired = ParseInt(args[2], "number of required shares");
 
   // limiting to 240 shares.
   // it makes no sense for only 1 share to be required to recover.
@@ -133,8 +291,322 @@ static void ParseNUMs(const std::vector<std::string> & args,
          "You must specify between 2 and numShares (%d) required shares", numShares);
 }
 
-static void run_aont(const std::vector<std::string> & args)
+/**
+ * @brief split argv into positional arguments and "--" options
+ */
+static void ParseArgs(const int argc, char ** argv,
+                      std::vector<std::string> & args,
+                      Options & opts)
 {
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    const std::string arg(argv[idx]);
+    if ((arg.size() <= 2) || (arg.compare(0, 2, "--")))
+    {
+      args.push_back(arg);
+      continue;
+    }
+    const size_t eq = arg.find('=');
+    const std::string name(arg.substr(2, eq - 2));
+    attest((name == "cipher")  ||
+           (name == "digest")  ||
+           (name == "segment") ||
+           (name == "compress") ||
+           (name == "decrypt") ||
+           (name == "prefer") ||
+           (name == "search") ||
+           (name == "shares") ||
+           (name == "batch") ||
+           (name == "hedge") ||
+           (name == "correct") ||
+           (name == "range") ||
+           (name == "repair") ||
+           (name == "extend") ||
+           (name == "reshare") ||
+           (name == "verify") ||
+           (name == "self-test") ||
+           (name == "server") ||
+           (name == "priority") ||
+           (name == "crc"),
+           "unknown option \"%s\"", arg.c_str());
+    opts[name] = (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+  }
+}
+
+/**
+ * @brief look up the digest named by --digest, nullptr for the default
+ */
+static const EVP_MD * GetDigest(const Options & opts)
+{
+  const auto it = opts.find("digest");
+  if (it == opts.end())
+  {
+    return nullptr;
+  }
+  const EVP_MD * md = EVP_get_digestbyname(it->second.c_str());
+  attest(md, "unknown digest \"%s\"", it->second.c_str());
+  return md;
+}
+
+/**
+ * @brief look up the cipher named by --cipher, nullptr for the default
+ */
+static const EVP_CIPHER * GetCipher(const Options & opts)
+{
+  const auto it = opts.find("cipher");
+  if (it == opts.end())
+  {
+    return nullptr;
+  }
+  const EVP_CIPHER * cipher = EVP_get_cipherbyname(it->second.c_str());
+  attest(cipher, "unknown cipher \"%s\"", it->second.c_str());
+  return cipher;
+}
+
+/**
+ * @brief parse a size with an optional K, M or G suffix
+ */
+static size_t ParseSize(const std::string & str)
+{
+  size_t pos = 0;
+  size_t ret = 0;
+  try
+  {
+    ret = std::stoull(str, &pos);
+  }
+  catch (const std::exception &)
+  {
+    attest(false, "invalid size \"%s\"", str.c_str());
+  }
+  const std::string suffix(str.substr(pos));
+  const int shift =
+    (suffix == "")  ?  0 :
+    (suffix == "K") ? 10 :
+    (suffix == "M") ? 20 :
+    (suffix == "G") ? 30 : -1;
+  attest(shift >= 0, "invalid size \"%s\"", str.c_str());
+  return ret << shift;
+}
+
+/**
+ * @brief package options given by --segment and --compress
+ */
+static PackageOptions GetPackageOptions(const Options & opts)
+{
+  PackageOptions ret;
+  const auto it = opts.find("segment");
+  if (it != opts.end())
+  {
+    ret.segmentSize = ParseSize(it->second.empty() ? "16M" : it->second);
+  }
+  const auto jt = opts.find("compress");
+  if (jt != opts.end())
+  {
+    ret.compression = jt->second.empty() ? 6 :
+      ParseInt(jt->second, "compression level");
+    attest((ret.compression >= 1) && (ret.compression <= 9),
+           "compression level must be between 1 and 9");
+  }
+  return ret;
+}
+
+/**
+ * @brief share selection given by --prefer, and --range
+ */
+static RecoveryOptions GetRecoveryOptions(const Options & opts)
+{
+  RecoveryOptions ret;
+  const auto jt = opts.find("range");
+  if (jt != opts.end())
+  {
+    const size_t colon = jt->second.find(':');
+    ret.offset = ParseSize(jt->second.substr(0, colon));
+    if (colon != std::string::npos)
+    {
+      ret.length = ParseSize(jt->second.substr(colon + 1));
+    }
+  }
+  const auto bt = opts.find("batch");
+  if (bt != opts.end())
+  {
+    ret.batch = ParseSize(bt->second);
+    attest(ret.batch, "invalid batch size \"%s\"", bt->second.c_str());
+  }
+  const auto ht = opts.find("hedge");
+  if (ht != opts.end())
+  {
+    ret.hedge = ht->second.empty() ? 1 : ParseInt(ht->second, "hedge");
+    attest(ret.hedge > 0, "invalid hedge \"%s\"", ht->second.c_str());
+  }
+  ret.correct = opts.count("correct");
+  const auto st = opts.find("shares");
+  if (st != opts.end())
+  {
+    std::istringstream list(st->second);
+    std::string file;
+    while (std::getline(list, file, ','))
+    {
+      if (!file.empty())
+      {
+        ret.shares.push_back(file);
+      }
+    }
+  }
+  const auto kt = opts.find("search");
+  if (kt != opts.end())
+  {
+    std::istringstream list(kt->second);
+    std::string dir;
+    while (std::getline(list, dir, ':'))
+    {
+      if (!dir.empty())
+      {
+        ret.search.push_back(dir);
+      }
+    }
+  }
+  const auto it = opts.find("prefer");
+  if (it == opts.end())
+  {
+    return ret;
+  }
+  std::istringstream list(it->second);
+  std::string item;
+  while (std::getline(list, item, ','))
+  {
+    if (item == "fastest")
+    {
+      ret.fastest = true;
+      continue;
+    }
+    size_t pos = 0;
+    unsigned long idx = 250;
+    try
+    {
+      idx = std::stoul(item, &pos, 16);
+    }
+    catch (const std::exception &)
+    {
+    }
+    attest((pos == item.size()) && (idx < 250),
+           "invalid share \"%s\"", item.c_str());
+    ret.prefer.push_back(idx);
+  }
+  return ret;
+}
+
+/**
+ * @brief recover the package proc, locally or by the server, to output
+ */
+static void RecoverPackage(const std::string & proc,
+                           const std::string & output,
+                           const std::string & server,
+                           const Options & opts,
+                           const int priority)
+{
+  if (server.empty())
+  {
+    RecoverData(proc, output, GetRecoveryOptions(opts));
+  }
+  else
+  {
+    attest(RecoverRemote(server, proc, output, opts.count("correct"),
+                         priority),
+           "unable to recover %s", proc.c_str());
+  }
+}
+
+/**
+ * @brief recover the package proc and decrypt it to STDOUT
+ *
+ * A segmented package is decrypted as it's recovered, through a pipe,
+ * without touching the disk. A single package has to be read twice to
+ * decrypt, so it's recovered to proc first.
+ */
+static void RecoverToStdout(const std::string & proc,
+                            const std::string & server,
+                            const Options & opts,
+                            const int priority)
+{
+  // recover the start of the package to see which it is
+  int pipefd[2];
+  attest(!pipe(pipefd), "pipe: %m");
+  const std::string writer("/dev/fd/" + std::to_string(pipefd[1]));
+  Options head(opts);
+  head["range"] = "0:" + std::to_string(sizeof(packageHeader));
+  RecoverData(proc, writer, GetRecoveryOptions(head));
+  close(pipefd[1]);
+  packageHeader hdr;
+  const ssize_t len = read(pipefd[0], &hdr, sizeof(hdr));
+  close(pipefd[0]);
+  if (!isSegmented(&hdr, std::max(len, (ssize_t)0)))
+  {
+    RecoverPackage(proc, proc, server, opts, priority);
+    decrypt(proc, STDOUT_FILENO);
+    return;
+  }
+
+  // a failed decrypt stops the recovery with EPIPE rather than SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  attest(!pipe(pipefd), "pipe: %m");
+  std::exception_ptr thrown;
+  std::thread recovery([&]()
+    {
+      try
+      {
+        RecoverPackage(proc, "/dev/fd/" + std::to_string(pipefd[1]),
+                       server, opts, priority);
+      }
+      catch (...)
+      {
+        thrown = std::current_exception();
+      }
+      close(pipefd[1]);
+    });
+  try
+  {
+    decrypt(pipefd[0], STDOUT_FILENO);
+  }
+  catch (...)
+  {
+    close(pipefd[0]);
+    recovery.join();
+    // a failed recovery is why the decrypt failed
+    std::rethrow_exception(thrown ? thrown : std::current_exception());
+  }
+  close(pipefd[0]);
+  recovery.join();
+  if (thrown)
+  {
+    std::rethrow_exception(thrown);
+  }
+}
+
+static void run_aont(const std::vector<std::string> & args,
+                     const Options & opts)
+{
+  const EVP_MD     * md      = GetDigest(opts);
+  const EVP_CIPHER * cipher  = GetCipher(opts);
+  const PackageOptions options = GetPackageOptions(opts);
+
+  // explicit decryption, from a file or STDIN (segmented packages only)
+  if (opts.count("decrypt") && (args.size() <= 2))
+  {
+    const std::string input (args.size() > 0 ? args[0] : "-");
+    const std::string output(args.size() > 1 ? args[1] : "-");
+    std::cerr << "decrypt " << ((input  == "-") ? "STDIN"  : input)
+              << " to "     << ((output == "-") ? "STDOUT" : output)
+              << std::endl;
+    const int fdIn = (input == "-") ? STDIN_FILENO :
+      open(input.c_str(), O_RDONLY);
+    attest(fdIn != -1, "open(%s, RDONLY): %m", input.c_str());
+    const int fdOut = (output == "-") ? STDOUT_FILENO :
+      open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    attest(fdOut != -1, "open(%s, WRONLY): %m", output.c_str());
+    decrypt(fdIn, fdOut);
+    exit(0);
+  }
+
   // streaming STDIN to STDOUT?
   const bool stream = ((args.size()  == 0) ||
                        ((args.size() == 1) &&
@@ -142,7 +614,24 @@ static void run_aont(const std::vector<std::string> & args)
   if (stream)
   {
     std::cerr << "encrypt STDIN to STDOUT" << std::endl;
-    encrypt();
+    encrypt(md, cipher, nullptr, options);
+    exit(0);
+  }
+
+  // decrypting to a given file, or STDOUT?
+  if ((args.size() == 2) && ends_with(args[0], ".aont"))
+  {
+    const std::string & stub(args[0]);
+    const std::string & plaintext(args[1]);
+    if (plaintext == "-")
+    {
+      std::cerr << "decrypt " << stub << " to STDOUT" << std::endl;
+      decrypt(stub, STDOUT_FILENO);
+      exit(0);
+    }
+    std::cerr << "decrypt " << stub << " to " << plaintext
+              << std::endl;
+    decrypt(stub, plaintext);
     exit(0);
   }
 
@@ -168,24 +657,27 @@ static void run_aont(const std::vector<std::string> & args)
   {
     std::cerr << "encrypt " << stub << " to " << encrypted
               << std::endl;
-    encrypt(stub, encrypted);
+    encrypt(stub, encrypted, md, cipher, nullptr, options);
     exit(0);
   }
 
   std::cerr << "encrypt STDIN to " << encrypted
             << std::endl;
-  encrypt(STDIN_FILENO, encrypted);
+  encrypt(STDIN_FILENO, encrypted, md, cipher, nullptr, options);
   exit(0);
 }
 
 int main(int argc, char ** argv)
 {
+  std::set_terminate(Terminate);
   attest((argc >= 1) && (argv != NULL) && (argv[0] != NULL),
          "main(%d,%p): INVALID", argc, argv);
 
-  // extract program name and arguments
+  // extract program name, arguments and options
   const std::string prog(argv[0]);
-  const std::vector<std::string> args(argv + 1, argv + argc);
+  std::vector<std::string> args;
+  Options opts;
+  ParseArgs(argc, argv, args, opts);
 
   // mode (gfm, aont, slss or show license)
   const bool RunAsGFM  = ends_with(prog, "gfm");
@@ -198,19 +690,99 @@ int main(int argc, char ** argv)
   // AONT mode?
   if (RunAsAONT)
   {
-    run_aont(args);
+    run_aont(args, opts);
     rtfm_aont(prog, copying);
   }
 
   // not AONT mode, so it's either SLSS or GFM
-  // single parameter is recovery mode
-  if (args.size() == 1)
+  if (opts.count("self-test") && args.empty())
+  {
+    SelfTest();
+    std::cerr << "self-test passed" << std::endl;
+    exit(0);
+  }
+  // run jobs for others?
+  if ((args.size() == 2) && (args[0] == "serve"))
+  {
+    Serve(args[1]);
+  }
+  // or have the server run ours?
+  const auto st = opts.find("server");
+  const std::string server(st == opts.end() ? "" : st->second);
+  const auto pt = opts.find("priority");
+  const int priority = (pt == opts.end()) ? 0 :
+    ParseInt(pt->second, "priority");
+  attest(server.empty() || !(opts.count("prefer") || opts.count("search") ||
+                             opts.count("shares") || opts.count("batch") ||
+                             opts.count("hedge")  || opts.count("range")),
+         "--server only supports --crc and --correct");
+
+  // rebuild missing shares?
+  if (opts.count("repair") && (args.size() == 1))
+  {
+    const std::string & stub(args[0]);
+    const bool aha = ends_with(stub, ".aont");
+    const std::string proc(stub + ((RunAsGFM || aha) ? "" : ".aont"));
+    std::cerr << "repairing shares of " << proc << std::endl;
+    RepairShares(proc);
+    exit(0);
+  }
+  // check the shares?
+  if (opts.count("verify") && (args.size() == 1))
+  {
+    const std::string & stub(args[0]);
+    const bool aha = ends_with(stub, ".aont");
+    const std::string proc(stub + ((RunAsGFM || aha) ? "" : ".aont"));
+    std::cerr << "verifying shares of " << proc << std::endl;
+    exit((server.empty() ? VerifyShares(proc) :
+          VerifyRemote(server, proc, priority)) ? 0 : 1);
+  }
+  // re-split with a new number of shares?
+  if (opts.count("reshare") && (args.size() == 3))
+  {
+    const std::string & stub(args[0]);
+    const bool aha = ends_with(stub, ".aont");
+    const std::string proc(stub + ((RunAsGFM || aha) ? "" : ".aont"));
+    int numShares;
+    int numRequired;
+    ParseNUMs(args, numShares, numRequired);
+    std::cerr << "re-split " << proc << " into " << numShares
+              << " shares of which " << numRequired
+              << " are required to recover "
+              << std::endl;
+    ReshareData(numRequired, numShares - numRequired, proc);
+    exit(0);
+  }
+  // add parity shares?
+  if (opts.count("extend") && (args.size() == 1))
+  {
+    const std::string & stub(args[0]);
+    const bool aha = ends_with(stub, ".aont");
+    const std::string proc(stub + ((RunAsGFM || aha) ? "" : ".aont"));
+    const std::string & num(opts["extend"]);
+    const int numNew = num.empty() ? 1 : ParseInt(num, "number of shares");
+    attest((numNew >= 1) && (numNew <= 240),
+           "You must specify between 1 and 240 new shares");
+    std::cerr << "adding " << numNew << " shares to " << proc << std::endl;
+    ExtendShares(proc, numNew);
+    exit(0);
+  }
+
+  // single parameter is recovery mode, a second one names the output
+  if ((args.size() == 1) || ((args.size() == 2) && !show))
   {
     const std::string stub(args[0]);
     if (RunAsGFM)
     {
-      std::cerr << "recovering " << stub  << std::endl;
-      RecoverData(stub);
+      const std::string output(args.size() == 2 ? args[1] : stub);
+      std::cerr << "recovering " << stub << " to "
+                << ((output == "-") ? "STDOUT" : output) << std::endl;
+      if (!server.empty())
+      {
+        exit(RecoverRemote(server, stub, output, opts.count("correct"),
+                           priority) ? 0 : 1);
+      }
+      RecoverData(stub, output, GetRecoveryOptions(opts));
     }
     else
     {
@@ -218,11 +790,22 @@ int main(int argc, char ** argv)
       // does stub "already have aont" extension?
       const bool aha =  ends_with(stub, ".aont");
       const std::string proc(stub + (aha ? "" : ".aont"));
-      const std::string plaintext(stub.substr(0,len-(aha ? 5 : 0)));
-      std::cerr << "recovering and decrypting " << plaintext
+      const std::string plaintext(args.size() == 2 ? args[1] :
+                                  stub.substr(0,len-(aha ? 5 : 0)));
+      // the whole package is needed to decrypt any of it
+      attest(!opts.count("range"), "--range is only supported by gfm");
+      std::cerr << "recovering and decrypting " << stub << " to "
+                << ((plaintext == "-") ? "STDOUT" : plaintext)
                 << std::endl;
-      RecoverData(proc);
-      decrypt(proc, plaintext);
+      if (plaintext == "-")
+      {
+        RecoverToStdout(proc, server, opts, priority);
+      }
+      else
+      {
+        RecoverPackage(proc, proc, server, opts, priority);
+        decrypt(proc, plaintext);
+      }
     }
     exit(0);
   }
@@ -246,7 +829,12 @@ int main(int argc, char ** argv)
                 << " shares of which " << numRequired
                 << " are required to recover "
                 << std::endl;
-      CreateParity(numData, numParity, stub);
+      if (!server.empty())
+      {
+        exit(SplitRemote(server, numData, numParity, stub,
+                         opts.count("crc"), priority) ? 0 : 1);
+      }
+      CreateParity(numData, numParity, stub, opts.count("crc"));
     }
     else
     {
@@ -257,7 +845,8 @@ int main(int argc, char ** argv)
                   << " encrypted shares of which " << numRequired
                   << " are required to recover "
                   << std::endl;
-        encrypt(stub, encrypted);
+        encrypt(stub, encrypted, GetDigest(opts), GetCipher(opts),
+                nullptr, GetPackageOptions(opts));
       }
       else
       {
@@ -265,9 +854,15 @@ int main(int argc, char ** argv)
                   << " encrypted shares of which " << numRequired
                   << " are required to recover "
                   << std::endl;
-        encrypt(STDIN_FILENO, encrypted);
+        encrypt(STDIN_FILENO, encrypted, GetDigest(opts), GetCipher(opts),
+                nullptr, GetPackageOptions(opts));
+      }
+      if (!server.empty())
+      {
+        exit(SplitRemote(server, numData, numParity, encrypted,
+                         opts.count("crc"), priority) ? 0 : 1);
       }
-      CreateParity(numData, numParity, encrypted);
+      CreateParity(numData, numParity, encrypted, opts.count("crc"));
     }
     exit(0);
   }
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <stdexcept>
 #include <string>
 
-/// fancy assert
+/// what attest() throws
+class SlssError : public std::runtime_error
+{
+public:
+  using std::runtime_error::runtime_error;
+};
+
+/// fancy assert, throws SlssError with the message if test fails
 void attest(bool test, const char * epilogue, ...)
   __attribute__ ((format (printf, 2, 3)));
 
-bool endswith(std::string const & str, std::string const & end);
+bool ends_with(std::string const & str, std::string const & end);